@@ -6,6 +6,7 @@
 #include <GL/glut.h>
 #include "bitmap_image.hpp"
 #include "stb_image.h"
+#include "trace.h"
 // Forward declarations
 class Object;
 class PointLight;
@@ -54,6 +55,59 @@ public:
     Ray(Vector3D start, Vector3D dir) : start(start), dir(dir.normalize()) {}
 };
 
+// Axis-aligned bounding box; starts empty, infinite extents mean unbounded
+struct Bounds {
+    Vector3D min, max;
+    
+    Bounds() : min(INFINITY, INFINITY, INFINITY), max(-INFINITY, -INFINITY, -INFINITY) {}
+    Bounds(Vector3D lo, Vector3D hi) : min(lo), max(hi) {}
+    
+    bool isEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+    bool isFinite() const {
+        return std::isfinite(min.x) && std::isfinite(min.y) && std::isfinite(min.z) &&
+               std::isfinite(max.x) && std::isfinite(max.y) && std::isfinite(max.z);
+    }
+    void extend(const Vector3D& p) {
+        min = Vector3D(std::fmin(min.x, p.x), std::fmin(min.y, p.y), std::fmin(min.z, p.z));
+        max = Vector3D(std::fmax(max.x, p.x), std::fmax(max.y, p.y), std::fmax(max.z, p.z));
+    }
+    void extend(const Bounds& b) {
+        if (b.isEmpty()) return;
+        extend(b.min);
+        extend(b.max);
+    }
+    Vector3D center() const { return (min + max) * 0.5; }
+    double radius() const { return (max - min).length() * 0.5; } // of the enclosing sphere
+};
+
+// Surface data at a ray hit, everything shading needs besides the object
+struct SurfaceHit {
+    Vector3D point;
+    Vector3D normal;
+    Vector3D baseColor; // getColorAt(point)
+};
+
+// Material classes, picked from the coefficients so shading runs a kernel
+// specialized for the terms the material actually has
+enum MaterialClass {
+    MATERIAL_DIFFUSE,   // no specular, no reflection
+    MATERIAL_PHONG,     // specular, no reflection
+    MATERIAL_MIRROR,    // reflection (specular optional)
+    MATERIAL_TEXTURED   // color varies over the surface (floor); all terms
+};
+
+// x^n for integer n by repeated squaring
+inline double powInt(double x, int n) {
+    if (n < 0) return 1.0 / powInt(x, -n);
+    double result = 1.0;
+    while (n > 0) {
+        if (n & 1) result *= x;
+        x *= x;
+        n >>= 1;
+    }
+    return result;
+}
+
 // Base Object class
 class Object {
 public:
@@ -62,12 +116,14 @@ public:
     double color[3];
     double coEfficients[4]; // ambient, diffuse, specular, reflection
     int shine;
+    int materialClass;
     
     Object() {
         height = width = length = 0;
         color[0] = color[1] = color[2] = 0;
         coEfficients[0] = coEfficients[1] = coEfficients[2] = coEfficients[3] = 0;
         shine = 0;
+        materialClass = MATERIAL_TEXTURED; // most general kernel until coefficients are set
     }
     
     virtual void draw() {}
@@ -75,6 +131,19 @@ public:
     virtual Vector3D getNormal(Vector3D point) { return Vector3D(0, 0, 1); }
     virtual Vector3D getColorAt(Vector3D point) { return Vector3D(color[0], color[1], color[2]); }
     
+    virtual bool isTextured() { return false; } // true if getColorAt varies over the surface
+    virtual Bounds getBounds() { return Bounds(reference_point, reference_point); }
+    virtual void translate(const Vector3D& offset) { reference_point = reference_point + offset; }
+    
+    // Phong + reflection shading for a hit at distance t along r (intersection_implementations.cpp)
+    void shade(Ray* r, double t, double* color, int level);
+    SurfaceHit surfaceAt(Ray* r, double t);
+    // Same, from surface data computed earlier (e.g. a G-buffer)
+    void shadeHit(Ray* r, const SurfaceHit& hit, double* color, int level);
+    
+    template <bool Specular, bool Reflective, bool Textured>
+    void shadeKernel(Ray* r, const SurfaceHit& hit, double* color, int level);
+    
     void setColor(double r, double g, double b) {
         color[0] = r; color[1] = g; color[2] = b;
     }
@@ -84,6 +153,14 @@ public:
     void setCoEfficients(double amb, double diff, double spec, double refl) {
         coEfficients[0] = amb; coEfficients[1] = diff; 
         coEfficients[2] = spec; coEfficients[3] = refl;
+        classifyMaterial();
+    }
+    
+    void classifyMaterial() {
+        if (isTextured()) materialClass = MATERIAL_TEXTURED;
+        else if (coEfficients[3] > 0) materialClass = MATERIAL_MIRROR;
+        else if (coEfficients[2] != 0) materialClass = MATERIAL_PHONG;
+        else materialClass = MATERIAL_DIFFUSE;
     }
     
     virtual ~Object() {}
@@ -107,6 +184,10 @@ public:
     
     double intersect(Ray* r, double* color, int level) override;
     Vector3D getNormal(Vector3D point) override;
+    Bounds getBounds() override {
+        Vector3D extent(length, length, length);
+        return Bounds(reference_point - extent, reference_point + extent);
+    }
 };
 
 // Triangle class
@@ -129,6 +210,24 @@ public:
     
     double intersect(Ray* r, double* color, int level) override;
     Vector3D getNormal(Vector3D point) override;
+    Bounds getBounds() override {
+        Bounds bounds;
+        bounds.extend(a); bounds.extend(b); bounds.extend(c);
+        return bounds;
+    }
+    void translate(const Vector3D& offset) override {
+        a = a + offset; b = b + offset; c = c + offset;
+        reference_point = a;
+    }
+};
+
+// Special forms of a general quadric that have cheaper intersection kernels
+enum QuadricForm {
+    QUADRIC_GENERAL,
+    QUADRIC_SPHERE,     // A = B = C, no cross terms
+    QUADRIC_CYLINDER,   // circular, along a coordinate axis
+    QUADRIC_CONE,       // circular, along a coordinate axis
+    QUADRIC_PLANE       // only linear terms
 };
 
 // General Quadric class
@@ -137,12 +236,21 @@ public:
     double A, B, C, D, E, F, G, H, I, J; // coefficients of quadric equation
     Vector3D cube_ref_point;
     double cube_length, cube_width, cube_height;
+
+    // Set by classify()
+    int form;               // QuadricForm
+    Vector3D center;        // sphere center, point on the cylinder axis or cone apex
+    double shapeParam;      // sphere/cylinder radius squared, cone (radius per unit height) squared
+    int axis;               // cylinder/cone axis: 0 = x, 1 = y, 2 = z
+    Vector3D boxLo, boxHi;  // bounding box, infinite where unbounded
+    bool bounded;           // any bounding box dimension given
     
     GeneralQuadric(double coeffs[10], Vector3D ref, double l, double w, double h) {
         A = coeffs[0]; B = coeffs[1]; C = coeffs[2]; D = coeffs[3]; E = coeffs[4];
         F = coeffs[5]; G = coeffs[6]; H = coeffs[7]; I = coeffs[8]; J = coeffs[9];
         cube_ref_point = ref;
         cube_length = l; cube_width = w; cube_height = h;
+        classify();
     }
     
     // void draw() override {} // No OpenGL drawing for general quadrics
@@ -157,8 +265,19 @@ public:
     double intersect(Ray* r, double* color, int level) override;
     Vector3D getNormal(Vector3D point) override;
     bool isWithinBounds(Vector3D point); // Check if point is within bounding box
+    Bounds getBounds() override;
+    void translate(const Vector3D& offset) override;
+
+    // Detect the quadric's form from its coefficients; call again after changing them
+    void classify();
+
+private:
+    bool missesBounds(const Ray* r) const;  // slab test against the bounding box
+    double nearestRoot(Ray* r, double aq, double bq, double cq);
 };
 
+const char* quadricFormName(int form);
+
 // Floor class
 // Floor class with texture support
 class Floor : public Object {
@@ -183,6 +302,7 @@ public:
     
     // Load texture from file
     bool loadTexture(const char* filename) {
+        TraceScope span("texture load", "load");
         if (textureData) {
             stbi_image_free(textureData);
         }
@@ -252,6 +372,11 @@ public:
     double intersect(Ray* r, double* color, int level) override;
     Vector3D getNormal(Vector3D point) override { return Vector3D(0, 0, 1); }
     Vector3D getColorAt(Vector3D point) override;
+    bool isTextured() override { return true; } // checkerboard or texture
+    Bounds getBounds() override {
+        return Bounds(Vector3D(-floorWidth / 2, -floorWidth / 2, 0), Vector3D(floorWidth / 2, floorWidth / 2, 0));
+    }
+    void translate(const Vector3D& offset) override {} // the floor stays centered at the origin
 };
 
 // Point Light class
@@ -296,5 +421,6 @@ public:
 void loadData();
 void capture();
 double clamp(double value, double min_val, double max_val);
+int findNearestObject(Ray* ray, double& tMin); // index into objects, -1 if nothing is hit
 
 #endif // CLASSES_H
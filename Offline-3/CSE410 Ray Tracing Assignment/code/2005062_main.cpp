@@ -1,9 +1,18 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <chrono>
+#include <thread>
 #include <GL/glut.h>
 #include "stb_image.h"
 #include "2005062_classes.h"
+#include "light_table.h"
+#include "light_tree.h"
+#include "scene.h"
+#include "bvh.h"
+#include "renderer.h"
+#include "tile_cache.h"
+#include "reprojection.h"
 using namespace std;
 // Global variables
 vector<Object*> objects;
@@ -22,6 +31,23 @@ int imageWidth = 4096, imageHeight = 4096;  // Increased from 768x768
 double viewAngle = 80.0; // in degrees
 int windowWidth = 500, windowHeight = 500;
 
+// Primary hits of the last capture, for relight-only re-renders
+GBuffer gbuffer;
+bool keepGBuffer = false;
+
+// Last captured frame and what each of its tiles touched, for incremental re-renders
+bitmap_image lastImage;
+TileCache tileCache;
+int selectedObject = -1; // object moved by the layout keys
+
+// Progressive ray-traced preview shown in the window instead of the OpenGL scene
+bool previewMode = false;
+GBuffer previewHits;            // hits of the preview; its camera is the one the preview was made for
+bitmap_image previewImage;
+vector<int> previewOrder;       // pixels to (re)trace, those without a reprojected sample first
+size_t previewNext = 0;
+const int PREVIEW_BATCH = 4096; // pixels traced per idle callback
+
 // Function to initialize camera vectors
 void updateCameraVectors() {
     look = look.normalize();
@@ -114,6 +140,9 @@ void loadData() {
         return;
     }
     
+    // Clear existing data
+    clearScene();
+    
     // Read recursion level and image dimensions
     file >> recursionLevel;
     file >> imageWidth;
@@ -139,7 +168,7 @@ void loadData() {
             file >> amb >> diff >> spec >> refl;
             file >> shine;
             
-            Sphere* sphere = new Sphere(Vector3D(cx, cy, cz), radius);
+            Sphere* sphere = sceneArena.make<Sphere>(Vector3D(cx, cy, cz), radius);
             sphere->setColor(r, g, b);
             sphere->setCoEfficients(amb, diff, spec, refl);
             sphere->setShine(shine);
@@ -158,9 +187,9 @@ void loadData() {
             file >> amb >> diff >> spec >> refl;
             file >> shine;
             
-            Triangle* triangle = new Triangle(Vector3D(x1, y1, z1), 
-                                            Vector3D(x2, y2, z2), 
-                                            Vector3D(x3, y3, z3));
+            Triangle* triangle = sceneArena.make<Triangle>(Vector3D(x1, y1, z1), 
+                                                           Vector3D(x2, y2, z2),
+                                                           Vector3D(x3, y3, z3));
             triangle->setColor(r, g, b);
             triangle->setCoEfficients(amb, diff, spec, refl);
             triangle->setShine(shine);
@@ -181,8 +210,8 @@ void loadData() {
             file >> amb >> diff >> spec >> refl;
             file >> shine;
             
-            GeneralQuadric* quad = new GeneralQuadric(coeffs, Vector3D(ref_x, ref_y, ref_z), 
-                                                     length, width, height);
+            GeneralQuadric* quad = sceneArena.make<GeneralQuadric>(coeffs, Vector3D(ref_x, ref_y, ref_z), 
+                                                                   length, width, height);
             quad->setColor(r, g, b);
             quad->setCoEfficients(amb, diff, spec, refl);
             quad->setShine(shine);
@@ -191,7 +220,7 @@ void loadData() {
     }
     
     // Add floor
-    Floor* floor = new Floor(1000, 20);
+    Floor* floor = sceneArena.make<Floor>(1000, 20);
     floor->setColor(1, 1, 1); // will be overridden by checkerboard pattern or texture
     floor->setCoEfficients(0.4, 0.2, 0.2, 0.2);
     floor->setShine(1);
@@ -248,6 +277,10 @@ void loadData() {
     }
     // for all the objects;  
     file.close();
+    
+    finalizeScene();
+    buildLightTable();
+    buildLightTree();
     // cout << "Loaded " << objects.size() << " objects, " 
             //   << pointLights.size() << " point lights, " 
             //   << spotLights.size() << " spotlights" << endl;
@@ -266,83 +299,210 @@ void showProgress(int percentage) {
 }
 
 
-// Capture function for ray tracing (basic structure)
-void capture() {
-    // cout << "Starting ray tracing..." << endl;
-    
-    bitmap_image image(imageWidth, imageHeight);
-    
-    // Set background color
+// Current camera for the renderer
+Camera currentCamera() {
+    return Camera{eye, look, up, rightV, viewAngle, windowWidth, windowHeight};
+}
 
-    for (int i = 0; i < imageWidth; i++) {
-        for (int j = 0; j < imageHeight; j++) {
-            image.set_pixel(i, j, 0, 0, 0); // black background
-        }
+// Trace pixel number 'index' of the preview
+void tracePreviewPixel(const ImagePlane& plane, int index) {
+    int i = index % plane.width, j = index / plane.width;
+    seedLightSampling(i, j, 0);
+    writePixel(previewImage, i, j, tracePixel(plane, i, j, &previewHits));
+}
+
+// Trace the next batch of preview pixels while the viewer is idle
+void previewIdle() {
+    if (!previewMode || previewNext >= previewOrder.size()) {
+        glutIdleFunc(nullptr);
+        return;
+    }
+    ImagePlane plane(previewHits.camera, previewImage.width(), previewImage.height());
+    size_t end = min(previewOrder.size(), previewNext + PREVIEW_BATCH);
+    for (; previewNext < end; previewNext++) {
+        tracePreviewPixel(plane, previewOrder[previewNext]);
+    }
+    glutPostRedisplay();
+}
+
+// Start the preview for the current camera. The previous preview is reprojected into
+// the new view; pixels it doesn't cover are traced right away and the rest are
+// re-traced progressively from previewIdle().
+void startPreview() {
+    Camera camera = currentCamera();
+    int w = windowWidth, h = windowHeight;
+    vector<char> reprojected;
+    
+    if (!previewHits.objectId.empty() && previewHits.width == w && previewHits.height == h) {
+        GBuffer newHits;
+        bitmap_image newImage(w, h);
+        reprojectFrame(previewHits, previewImage, camera, newHits, newImage, reprojected);
+        previewHits = newHits;
+        previewImage = newImage;
+    } else {
+        previewHits.resize(camera, w, h);
+        previewImage.setwidth_height(w, h);
+        previewImage.set_all_channels(0, 0, 0);
+        reprojected.assign(w * h, 0);
     }
     
+    int unsampled;
+    refinementOrder(reprojected, previewOrder, unsampled);
+    ImagePlane plane(camera, w, h);
+    for (int n = 0; n < unsampled; n++) {
+        tracePreviewPixel(plane, previewOrder[n]);
+    }
+    previewNext = unsampled;
+    glutIdleFunc(previewIdle);
+}
+
+// Scene edits make the preview stale; trace it again from scratch
+void resetPreview() {
+    previewHits.clear();
+    if (previewMode) glutPostRedisplay();
+}
 
-    // Calculate plane distance and setup
-    double planeDistance = (windowHeight / 2.0) / tan((viewAngle * M_PI / 180.0) / 2.0);
-    Vector3D topleft = eye + look * planeDistance - rightV * (windowWidth / 2.0) + up * (windowHeight / 2.0);
+// Draw the preview image over the whole window
+void drawPreview() {
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glDisable(GL_DEPTH_TEST);
     
-    double du = (double)windowWidth / imageWidth;
-    double dv = (double)windowHeight / imageHeight;
+    // bitmap_image rows are top-down BGR, so draw from the top-left corner downwards
+    glRasterPos2f(-1, 1);
+    glPixelZoom((float)glutGet(GLUT_WINDOW_WIDTH) / previewImage.width(),
+                -(float)glutGet(GLUT_WINDOW_HEIGHT) / previewImage.height());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glDrawPixels(previewImage.width(), previewImage.height(), GL_BGR, GL_UNSIGNED_BYTE, previewImage.data());
     
-    topleft = topleft + rightV * (0.5 * du) - up * (0.5 * dv);
+    glEnable(GL_DEPTH_TEST);
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
+enum CaptureMode {
+    CAPTURE_FULL,
+    CAPTURE_RELIGHT,        // re-shade from the G-buffer
+    CAPTURE_INCREMENTAL     // re-render only tiles invalidated since the last capture
+};
+
+// Render and save an image. Relight and incremental captures fall back to a
+// full render when the last capture was for a different view.
+void captureImage(CaptureMode mode) {
+    Camera camera = currentCamera();
+    bool relight = mode == CAPTURE_RELIGHT;
+    if (relight && !gbuffer.matches(camera, imageWidth, imageHeight)) {
+        cout << "No G-buffer for this view, rendering from scratch" << endl;
+        relight = false;
+    }
+    bool incremental = mode == CAPTURE_INCREMENTAL && tileCache.matches(camera, imageWidth, imageHeight)
+                       && (!keepGBuffer || gbuffer.matches(camera, imageWidth, imageHeight));
+    if (mode == CAPTURE_INCREMENTAL && !incremental) {
+        cout << "No previous frame for this view, rendering from scratch" << endl;
+    }
     
-    // Ray tracing loop
-    for (int i = 0; i < imageWidth; i++) {
-        for (int j = 0; j < imageHeight; j++) {
-            // Calculate current pixel position
-            Vector3D curPixel = topleft + rightV * (i * du) - up * (j * dv);
-            Vector3D rayDir = (curPixel - eye).normalize();
-            
-            Ray ray(eye, rayDir);
-            
-            // Find nearest intersection
-            double tMin = -1;
-            int nearest = -1;
-            
-            for (int k = 0; k < objects.size(); k++) {
-                double t = objects[k]->intersect(&ray, nullptr, 0);
-                if (t > 0 && (tMin < 0 || t < tMin)) {
-                    tMin = t;
-                    nearest = k;
-                }
-            }
-            
-            // Color the pixel
-            if (nearest != -1) {
-                double color[3] = {0.0, 0.0, 0.0};
-                objects[nearest]->intersect(&ray, color, 1);
-                
-                // Clamp colors to [0,1] and convert to [0,255]
-                int r = (int)(clamp(color[0], 0.0, 1.0) * 255);
-                int g = (int)(clamp(color[1], 0.0, 1.0) * 255);
-                int b = (int)(clamp(color[2], 0.0, 1.0) * 255);
-                
-                image.set_pixel(i, j, r, g, b);
-            }
-        }
-        
-        // Progress indicator
-        if (i % 50 == 0) {
-            showProgress(i * 100 / imageWidth);
-        }
+    if (!incremental) {
+        lastImage.setwidth_height(imageWidth, imageHeight);
+        lastImage.set_all_channels(0, 0, 0); // black background
     }
     
-    // Ensure 100% is shown at completion
-    showProgress(100);
+    RenderOptions options;
+    options.gbuffer = (keepGBuffer || relight) ? &gbuffer : nullptr;
+    options.relight = relight;
+    options.tileCache = &tileCache;
+    options.incremental = incremental;
+    int dirtyTiles = incremental ? tileCache.dirtyCount() : tileCache.tilesX * tileCache.tilesY;
+    
+    auto start = chrono::steady_clock::now();
+    renderImage(camera, lastImage, options);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
     
     // Save image
     static int imageCount = 1;
     // find how many images are in the directory
     string filename = "Output_" + to_string(imageCount) + ".bmp";
-    image.save_image(filename);
+    lastImage.save_image(filename);
     imageCount++;
     
-    // printf("\nRay tracing completed!\n");
-    cout << "\nImage saved as " << filename << endl;
+    cout << "\nImage saved as " << filename;
+    if (relight) cout << " (relit)";
+    if (incremental) cout << " (" << dirtyTiles << " of " << tileCache.tiles.size() << " tiles re-rendered)";
+    cout << " in " << seconds << " s" << endl;
+}
+
+// Capture function for ray tracing
+void capture() {
+    captureImage(CAPTURE_FULL);
+}
+
+// Read the scene file again; everything cached for the old objects is dropped
+void reloadScene() {
+    loadData();
+    gbuffer.clear();
+    tileCache.clear();
+    selectedObject = -1;
+    resetPreview();
+    glutPostRedisplay();
+    cout << "Reloaded " << sceneFile << " (" << sceneArena.bytesUsed() / 1024 << " KB of objects)" << endl;
+}
+
+// Select the next object (other than the floor) for the layout keys
+void selectNextObject() {
+    for (int n = 0; n < (int)objects.size(); n++) {
+        selectedObject = (selectedObject + 1) % objects.size();
+        if (!dynamic_cast<Floor*>(objects[selectedObject])) {
+            Vector3D p = objects[selectedObject]->reference_point;
+            cout << "Selected object " << selectedObject << " at (" << p.x << ", " << p.y << ", " << p.z << ")" << endl;
+            return;
+        }
+    }
+    selectedObject = -1;
+    cout << "No movable objects in the scene" << endl;
+}
+
+// Move the selected object and re-render only the tiles it can affect
+void moveSelectedObject(const Vector3D& offset) {
+    if (selectedObject < 0 || selectedObject >= (int)objects.size()) {
+        cout << "No object selected (press 'o')" << endl;
+        return;
+    }
+    
+    Object* obj = objects[selectedObject];
+    Bounds oldBounds = obj->getBounds();
+    obj->translate(offset);
+    buildAccel();
+    resetPreview();
+    glutPostRedisplay();
+    
+    if (tileCache.matches(currentCamera(), imageWidth, imageHeight)) {
+        tileCache.invalidateObject(selectedObject, oldBounds, obj->getBounds());
+        captureImage(CAPTURE_INCREMENTAL);
+    }
+}
+
+// Scale every light color, then relight from the G-buffer if there is one for this view
+void scaleLights(double factor) {
+    for (auto& light : pointLights) {
+        for (int c = 0; c < 3; c++) light.color[c] *= factor;
+    }
+    for (auto& spotlight : spotLights) {
+        for (int c = 0; c < 3; c++) spotlight.point_light.color[c] *= factor;
+    }
+    buildLightTable();
+    buildLightTree();
+    tileCache.markAllDirty();
+    resetPreview();
+    cout << "Light intensity scaled by " << factor << endl;
+    
+    if (gbuffer.matches(currentCamera(), imageWidth, imageHeight)) {
+        captureImage(CAPTURE_RELIGHT);
+    }
 }
 
 // OpenGL display function
@@ -350,6 +510,15 @@ void display() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glLoadIdentity();
     
+    if (previewMode) {
+        if (previewHits.objectId.empty() || !sameCamera(previewHits.camera, currentCamera())) {
+            startPreview();
+        }
+        drawPreview();
+        glutSwapBuffers();
+        return;
+    }
+    
     // Set camera
     gluLookAt(eye.x, eye.y, eye.z,
               eye.x + look.x, eye.y + look.y, eye.z + look.z,
@@ -389,6 +558,9 @@ void keyboardHandler(unsigned char key, int x, int y) {
                 Floor* floor = dynamic_cast<Floor*>(obj);
                 if (floor) {
                     floor->setUseTexture(!floor->useTexture);
+                    gbuffer.clear(); // cached floor colors are stale
+                    tileCache.markAllDirty();
+                    resetPreview();
                     cout << "Floor texture " << (floor->useTexture ? "enabled" : "disabled") << endl;
                     glutPostRedisplay();
                     break;
@@ -403,6 +575,9 @@ void keyboardHandler(unsigned char key, int x, int y) {
                 Floor* floor = dynamic_cast<Floor*>(obj);
                 if (floor) {
                     floor->setTexturePerTile(!floor->texturePerTile);
+                    gbuffer.clear();
+                    tileCache.markAllDirty();
+                    resetPreview();
                     cout << "Texture mapping: " << (floor->texturePerTile ? "per tile" : "entire floor") << endl;
                     glutPostRedisplay();
                     break;
@@ -410,6 +585,36 @@ void keyboardHandler(unsigned char key, int x, int y) {
             }
             break;
         }
+        case 'g':
+        case 'G': {
+            // Keep primary hits of each capture for relight-only re-renders
+            keepGBuffer = !keepGBuffer;
+            if (!keepGBuffer) gbuffer.clear();
+            cout << "G-buffer caching " << (keepGBuffer ? "enabled" : "disabled") << endl;
+            break;
+        }
+        case 'r':
+        case 'R': captureImage(CAPTURE_RELIGHT); break;
+        case 'p':
+        case 'P': {
+            // Toggle the progressive ray-traced preview in the window
+            previewMode = !previewMode;
+            cout << "Ray-traced preview " << (previewMode ? "enabled" : "disabled") << endl;
+            glutPostRedisplay();
+            break;
+        }
+        case 'o':
+        case 'O': selectNextObject(); break;
+        case 'l':
+        case 'L': reloadScene(); break;
+        case 'w': moveSelectedObject(Vector3D(0, 5, 0)); break;
+        case 's': moveSelectedObject(Vector3D(0, -5, 0)); break;
+        case 'a': moveSelectedObject(Vector3D(-5, 0, 0)); break;
+        case 'd': moveSelectedObject(Vector3D(5, 0, 0)); break;
+        case 'q': moveSelectedObject(Vector3D(0, 0, -5)); break;
+        case 'e': moveSelectedObject(Vector3D(0, 0, 5)); break;
+        case '[': scaleLights(1.0 / 1.1); break;
+        case ']': scaleLights(1.1); break;
         case 'v':
         case 'V': {
             // Set image quality to 768x768
@@ -482,6 +687,9 @@ int main(int argc, char** argv) {
     glutCreateWindow("Offline 3 - Ray Tracing ");
     
     init();
+    // Reloads and object moves rebuild the acceleration structure, so it is built for speed
+    accelBuild = BUILD_LBVH;
+    accelBuildThreads = max(1u, thread::hardware_concurrency());
     loadData();
     
     glutDisplayFunc(display);
@@ -491,9 +699,7 @@ int main(int argc, char** argv) {
     glutMainLoop();
     
     // Clean up
-    for (auto obj : objects) {
-        delete obj;
-    }
+    clearScene();
     
     return 0;
 }
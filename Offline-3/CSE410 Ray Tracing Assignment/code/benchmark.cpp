@@ -0,0 +1,465 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <cstdio>
+#include "2005062_classes.h"
+#include "light_table.h"
+#include "light_tree.h"
+#include "scene.h"
+#include "bvh.h"
+#include "render_stats.h"
+#include "renderer.h"
+using namespace std;
+
+// Microbenchmarks of the intersection, texture and shading kernels on randomized rays,
+// acceleration structure builds over growing primitive counts, and full-frame renders of a
+// scene corpus through raytracer_headless. Results can be saved and compared against a saved
+// baseline.
+
+// Globals and helpers the library code expects from a main
+vector<Object*> objects;
+vector<PointLight> pointLights;
+vector<SpotLight> spotLights;
+int recursionLevel = 3;
+int imageWidth = 256, imageHeight = 256;
+
+double clamp(double value, double min_val, double max_val) {
+    if (value < min_val) return min_val;
+    if (value > max_val) return max_val;
+    return value;
+}
+
+void showProgress(int percentage) {}
+
+// One benchmark's timing over all runs
+struct BenchResult {
+    string name;
+    double nsPerOp = 0;         // median over runs
+    double deviation = 0;       // standard deviation over runs, percent of the mean
+    double mrays = 0;           // million rays per second at the median
+    int runs = 0;
+};
+
+int benchRuns = 10;
+double runMs = 50;              // target length of one timed run of a microbenchmark
+string benchFilter = "";        // run only benchmarks whose name contains this
+string textureFile = "";        // floor texture for the texture lookup benchmark
+volatile double sink;           // keeps results of the timed loops alive
+
+BenchResult summarize(const string& name, vector<double> nsPerOp, double raysPerOp) {
+    BenchResult result;
+    result.name = name;
+    result.runs = nsPerOp.size();
+    double mean = 0, variance = 0;
+    for (double ns : nsPerOp) mean += ns;
+    mean /= nsPerOp.size();
+    for (double ns : nsPerOp) variance += (ns - mean) * (ns - mean);
+    variance /= max<size_t>(1, nsPerOp.size() - 1);
+    sort(nsPerOp.begin(), nsPerOp.end());
+    result.nsPerOp = nsPerOp[nsPerOp.size() / 2];
+    result.deviation = mean > 0 ? sqrt(variance) / mean * 100 : 0;
+    result.mrays = result.nsPerOp > 0 ? raysPerOp / result.nsPerOp * 1000 : 0;
+    return result;
+}
+
+bool selected(const string& name) { return name.find(benchFilter) != string::npos; }
+
+// Time body(count) in benchRuns runs; count is calibrated once so a run takes about runMs.
+// Benchmarks the filter excludes come back with runs = 0.
+BenchResult measure(const string& name, const function<void(long)>& body, double raysPerOp = 1) {
+    if (!selected(name)) return BenchResult{name};
+    long count = 1;
+    while (true) {
+        auto start = chrono::steady_clock::now();
+        body(count);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        if (ms >= runMs / 4 || count >= (1L << 40)) {
+            count = max(1L, (long)(count * runMs / max(ms, 1e-3)));
+            break;
+        }
+        count *= 4;
+    }
+
+    vector<double> nsPerOp;
+    for (int run = 0; run < benchRuns; run++) {
+        auto start = chrono::steady_clock::now();
+        body(count);
+        nsPerOp.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / count);
+    }
+    return summarize(name, nsPerOp, raysPerOp);
+}
+
+// Rays from random points on a sphere of radius 'distance' around target, aimed at random points
+// within 'spread' of it, so roughly half of them hit an object of that size
+vector<Ray> randomRays(mt19937& rng, const Vector3D& target, double distance, double spread, int count) {
+    normal_distribution<double> gauss;
+    uniform_real_distribution<double> offset(-spread, spread);
+    vector<Ray> rays;
+    for (int k = 0; k < count; k++) {
+        Vector3D away = Vector3D(gauss(rng), gauss(rng), fabs(gauss(rng))).normalize();
+        Vector3D aim = target + Vector3D(offset(rng), offset(rng), offset(rng));
+        Vector3D start = target + away * distance;
+        rays.push_back(Ray(start, aim - start));
+    }
+    return rays;
+}
+
+const int RAY_COUNT = 4096;     // power of two; the loops index with & (RAY_COUNT - 1)
+
+BenchResult benchIntersect(const string& name, Object* object, const vector<Ray>& rays) {
+    return measure(name, [&](long count) {
+        double sum = 0;
+        for (long k = 0; k < count; k++) {
+            Ray ray = rays[k & (RAY_COUNT - 1)];
+            sum += object->intersect(&ray, nullptr, 0);
+        }
+        sink = sum;
+    });
+}
+
+BenchResult benchFloorColor(Floor* floor, mt19937& rng) {
+    uniform_real_distribution<double> coordinate(-floor->floorWidth / 2, floor->floorWidth / 2);
+    vector<Vector3D> points;
+    for (int k = 0; k < RAY_COUNT; k++) points.push_back(Vector3D(coordinate(rng), coordinate(rng), 0));
+    string name = floor->useTexture ? "floor.getColorAt.texture" : "floor.getColorAt.checker";
+    return measure(name, [&](long count) {
+        double sum = 0;
+        for (long k = 0; k < count; k++) sum += floor->getColorAt(points[k & (RAY_COUNT - 1)]).x;
+        sink = sum;
+    }, 0);
+}
+
+// Small lit scene: spheres of every material class, triangles, a quadric and the floor
+void buildShadingScene(mt19937& rng, int lightCount) {
+    clearScene();
+    uniform_real_distribution<double> unit(0, 1), position(-60, 60);
+    for (int k = 0; k < 24; k++) {
+        Sphere* sphere = sceneArena.make<Sphere>(Vector3D(position(rng), position(rng), 5 + 20 * unit(rng)),
+                                                 4 + 6 * unit(rng));
+        sphere->setColor(unit(rng), unit(rng), unit(rng));
+        int material = k % 3;   // diffuse, phong, mirror
+        sphere->setCoEfficients(0.2, 0.5, material > 0 ? 0.3 : 0, material == 2 ? 0.3 : 0);
+        sphere->setShine(10 + k);
+        objects.push_back(sphere);
+    }
+    for (int k = 0; k < 8; k++) {
+        Vector3D base(position(rng), position(rng), 0);
+        Triangle* triangle = sceneArena.make<Triangle>(base, base + Vector3D(20, 0, 0), base + Vector3D(10, 5, 25));
+        triangle->setColor(unit(rng), unit(rng), unit(rng));
+        triangle->setCoEfficients(0.2, 0.6, 0.2, 0);
+        triangle->setShine(20);
+        objects.push_back(triangle);
+    }
+    double ellipsoid[10] = {1, 2, 1, 0.5, 0, 0, 0, 0, 0, -400};
+    GeneralQuadric* quad = sceneArena.make<GeneralQuadric>(ellipsoid, Vector3D(0, 0, 0), 0, 0, 40);
+    quad->setColor(0.8, 0.6, 0.2);
+    quad->setCoEfficients(0.2, 0.5, 0.3, 0.2);
+    quad->setShine(30);
+    objects.push_back(quad);
+
+    Floor* floor = sceneArena.make<Floor>(1000, 20);
+    floor->setColor(1, 1, 1);
+    floor->setCoEfficients(0.4, 0.2, 0.2, 0.2);
+    floor->setShine(1);
+    objects.push_back(floor);
+
+    for (int k = 0; k < lightCount; k++) {
+        Vector3D at(position(rng) * 2, position(rng) * 2, 80 + 40 * unit(rng));
+        if (k % 4 == 3) {
+            PointLight light(at, 0.6, 0.6, 0.6);
+            spotLights.push_back(SpotLight(light, Vector3D(0, 0, 0) - at, 40));
+        } else {
+            pointLights.push_back(PointLight(at, 0.5, 0.5, 0.5));
+        }
+    }
+    finalizeScene();
+    buildLightTable();
+    buildLightTree();
+}
+
+// Closest hit plus full shading (shadow rays, reflections) for rays from a camera above the scene
+BenchResult benchShading(mt19937& rng, int lightCount) {
+    buildShadingScene(rng, lightCount);
+    vector<Ray> rays = randomRays(rng, Vector3D(0, 0, 10), 150, 70, RAY_COUNT);
+
+    RayCounters before = rayCounters;
+    long total = 0;
+    BenchResult result = measure("shade." + to_string(lightCount) + "lights", [&](long count) {
+        double sum = 0;
+        for (long k = 0; k < count; k++) {
+            Ray ray = rays[k & (RAY_COUNT - 1)];
+            double t, color[3] = {0, 0, 0};
+            int nearest = findNearestObject(&ray, t);
+            if (nearest != -1) objects[nearest]->intersect(&ray, color, 1);
+            sum += color[0];
+        }
+        total += count;
+        sink = sum;
+    });
+    if (total > 0) {
+        double raysPerOp = (double)(rayCounters.nearest + rayCounters.shadow - before.nearest - before.shadow) / total;
+        result.mrays = raysPerOp / result.nsPerOp * 1000;
+    }
+    clearScene();
+    return result;
+}
+
+vector<BenchResult> runMicrobenchmarks() {
+    vector<BenchResult> results;
+    mt19937 rng(2005062);
+
+    Sphere sphere(Vector3D(0, 0, 20), 20);
+    results.push_back(benchIntersect("sphere.intersect", &sphere, randomRays(rng, sphere.reference_point, 200, 40, RAY_COUNT)));
+
+    Triangle triangle(Vector3D(-20, -20, 0), Vector3D(20, -20, 0), Vector3D(0, 20, 30));
+    results.push_back(benchIntersect("triangle.intersect", &triangle, randomRays(rng, Vector3D(0, 0, 10), 200, 40, RAY_COUNT)));
+
+    // Tilted ellipsoid keeps the general kernel; the cylinder takes the specialized one
+    double general[10] = {1, 2, 1, 0.5, 0.3, 0, 0, 0, 0, -400};
+    GeneralQuadric generalQuad(general, Vector3D(0, 0, 0), 0, 0, 0);
+    results.push_back(benchIntersect("quadric.intersect.general", &generalQuad, randomRays(rng, Vector3D(0, 0, 0), 200, 40, RAY_COUNT)));
+    double cylinder[10] = {1, 1, 0, 0, 0, 0, 0, 0, 0, -400};
+    GeneralQuadric cylinderQuad(cylinder, Vector3D(0, 0, 0), 0, 0, 50);
+    results.push_back(benchIntersect("quadric.intersect.cylinder", &cylinderQuad, randomRays(rng, Vector3D(0, 0, 25), 200, 40, RAY_COUNT)));
+
+    Floor floor(1000, 20);
+    floor.setColor(1, 1, 1);
+    results.push_back(benchIntersect("floor.intersect", &floor, randomRays(rng, Vector3D(0, 0, 0), 200, 400, RAY_COUNT)));
+    results.push_back(benchFloorColor(&floor, rng));
+    if (!textureFile.empty() && floor.loadTexture(textureFile.c_str())) results.push_back(benchFloorColor(&floor, rng));
+
+    for (int lights : {4, 64}) results.push_back(benchShading(rng, lights));
+    results.erase(remove_if(results.begin(), results.end(), [](const BenchResult& result) { return result.runs == 0; }),
+                  results.end());
+    return results;
+}
+
+// BVH builds over 1k to 1M random spheres with each split method, on one thread so the curve
+// shows the builder rather than the machine's core count
+vector<BenchResult> runBuildBenchmarks() {
+    vector<BenchResult> results;
+    mt19937 rng(2005062);
+    const pair<int, const char*> sizes[] = {{1000, "1k"}, {10000, "10k"}, {100000, "100k"}, {1000000, "1m"}};
+    const BuildMethod methods[] = {BUILD_SAH, BUILD_LBVH};
+    for (const auto& size : sizes) {
+        bool wanted = false;
+        for (BuildMethod method : methods) {
+            wanted = wanted || selected(string("bvh.build.") + buildMethodName(method) + "." + size.second);
+        }
+        if (!wanted) continue;
+
+        // Same density at every size: the cube grows with the count
+        clearScene();
+        double extent = 10 * cbrt((double)size.first);
+        uniform_real_distribution<double> position(-extent, extent), radius(0.5, 2);
+        for (int k = 0; k < size.first; k++) {
+            objects.push_back(sceneArena.make<Sphere>(Vector3D(position(rng), position(rng), position(rng)), radius(rng)));
+        }
+
+        for (BuildMethod method : methods) {
+            string name = string("bvh.build.") + buildMethodName(method) + "." + size.second;
+            BenchResult result = measure(name, [&](long count) {
+                for (long k = 0; k < count; k++) sceneBVH.build(ACCEL_QBVH4, method, 1);
+            }, 0);
+            if (result.runs == 0) continue;
+            printf("  %-32s %10.2f ms  ±%5.1f%%\n", name.c_str(), result.nsPerOp / 1e6, result.deviation);
+            results.push_back(result);
+        }
+        sceneBVH.clear();
+        clearScene();
+    }
+    return results;
+}
+
+// Full frames: run the headless renderer on each scene and read its --stats report
+string headlessPath = "./raytracer_headless";
+string frameArgs = "";
+
+bool renderFrame(const string& scene, double& renderMs, double& mrays) {
+    string command = "\"" + headlessPath + "\" \"" + scene + "\" benchmark_frame.bmp --stats " + frameArgs + " 2>&1";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) return false;
+    renderMs = mrays = -1;
+    char line[512];
+    while (fgets(line, sizeof(line), pipe)) {
+        sscanf(line, " render %lf ms", &renderMs);
+        sscanf(line, " throughput %lf Mrays/s", &mrays);
+    }
+    int status = pclose(pipe);
+    return status == 0 && renderMs >= 0;
+}
+
+vector<BenchResult> runFrameBenchmarks(const vector<string>& scenes) {
+    vector<BenchResult> results;
+    for (const string& scene : scenes) {
+        string name = "frame." + filesystem::path(scene).stem().string();
+        vector<double> nsPerFrame;
+        double mrays = 0, renderMs;
+        bool ok = renderFrame(scene, renderMs, mrays);     // warm-up, also checks the scene renders
+        for (int run = 0; ok && run < benchRuns; run++) {
+            ok = renderFrame(scene, renderMs, mrays);
+            nsPerFrame.push_back(renderMs * 1e6);
+        }
+        if (!ok) {
+            cout << "  " << name << ": render failed, skipped" << endl;
+            continue;
+        }
+        BenchResult result = summarize(name, nsPerFrame, 0);
+        result.mrays = mrays;   // rays per frame are fixed, so the last run's rate stands for all
+        results.push_back(result);
+        printf("  %-32s %10.2f ms  ±%5.1f%%\n", name.c_str(), result.nsPerOp / 1e6, result.deviation);
+    }
+    remove("benchmark_frame.bmp");
+    return results;
+}
+
+// Scene files of the corpus directory, sorted by name
+vector<string> corpusScenes(const string& directory) {
+    vector<string> scenes;
+    error_code error;
+    for (const auto& entry : filesystem::directory_iterator(directory, error)) {
+        if (entry.path().extension() == ".txt") scenes.push_back(entry.path().string());
+    }
+    sort(scenes.begin(), scenes.end());
+    return scenes;
+}
+
+// Results file: one "name ns_per_op deviation_percent mrays runs" line per benchmark
+void saveResults(const vector<BenchResult>& results, const string& path) {
+    ofstream file(path);
+    file << "# benchmark ns_per_op deviation_percent mrays_per_s runs" << endl;
+    for (const BenchResult& result : results) {
+        file << result.name << " " << result.nsPerOp << " " << result.deviation << " " << result.mrays << " "
+             << result.runs << endl;
+    }
+}
+
+map<string, BenchResult> loadResults(const string& path) {
+    map<string, BenchResult> results;
+    ifstream file(path);
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        BenchResult result;
+        if (istringstream(line) >> result.name >> result.nsPerOp >> result.deviation >> result.mrays >> result.runs) {
+            results[result.name] = result;
+        }
+    }
+    return results;
+}
+
+// Table of results; with a baseline, the change in time and whether it is beyond the noise
+// (twice the larger of the two runs' deviations)
+void printResults(const vector<BenchResult>& results, const map<string, BenchResult>& baseline) {
+    printf("\n%-32s %14s %8s %10s", "benchmark", "ns/op", "±%", "Mrays/s");
+    if (!baseline.empty()) printf(" %10s", "vs base");
+    printf("\n");
+    for (const BenchResult& result : results) {
+        printf("%-32s %14.2f %8.1f %10.3f", result.name.c_str(), result.nsPerOp, result.deviation, result.mrays);
+        auto base = baseline.find(result.name);
+        if (base != baseline.end() && base->second.nsPerOp > 0) {
+            double change = (result.nsPerOp / base->second.nsPerOp - 1) * 100;
+            double noise = 2 * max(result.deviation, base->second.deviation);
+            printf(" %+9.1f%%%s", change, change > noise ? "  slower" : (change < -noise ? "  faster" : ""));
+        }
+        printf("\n");
+    }
+}
+
+void printUsage(const char* program) {
+    cout << "Usage: " << program << " [scene_files...] [options]" << endl;
+    cout << "Runs the kernel microbenchmarks and BVH builds, then renders each scene (default: every .txt in" << endl;
+    cout << "test_scenes)" << endl;
+    cout << "Options:" << endl;
+    cout << "  --runs N            timed runs per benchmark (default 10)" << endl;
+    cout << "  --run-ms MS         length of one microbenchmark run (default 50)" << endl;
+    cout << "  --filter TEXT       only benchmarks whose name contains TEXT" << endl;
+    cout << "  --texture FILE      also time floor texture lookups with this image" << endl;
+    cout << "  --no-micro          skip the microbenchmarks" << endl;
+    cout << "  --no-build          skip the acceleration structure builds (1k to 1M spheres)" << endl;
+    cout << "  --no-frames         skip the full-frame renders" << endl;
+    cout << "  --corpus DIR        directory of scene files to render (default test_scenes)" << endl;
+    cout << "  --headless PATH     renderer used for full frames (default ./raytracer_headless)" << endl;
+    cout << "  --frame-args ARGS   extra options passed to the renderer, e.g. \"--threads 4\"" << endl;
+    cout << "  --save FILE         write the results to FILE" << endl;
+    cout << "  --baseline FILE     compare against results saved earlier with --save" << endl;
+}
+
+int main(int argc, char** argv) {
+    vector<string> scenes;
+    string corpus = "test_scenes", saveFile, baselineFile;
+    bool micro = true, builds = true, frames = true;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--runs" && i + 1 < argc) {
+            benchRuns = max(2, atoi(argv[++i]));
+        } else if (arg == "--run-ms" && i + 1 < argc) {
+            runMs = max(1.0, atof(argv[++i]));
+        } else if (arg == "--filter" && i + 1 < argc) {
+            benchFilter = argv[++i];
+        } else if (arg == "--texture" && i + 1 < argc) {
+            textureFile = argv[++i];
+        } else if (arg == "--no-micro") {
+            micro = false;
+        } else if (arg == "--no-build") {
+            builds = false;
+        } else if (arg == "--no-frames") {
+            frames = false;
+        } else if (arg == "--corpus" && i + 1 < argc) {
+            corpus = argv[++i];
+        } else if (arg == "--headless" && i + 1 < argc) {
+            headlessPath = argv[++i];
+        } else if (arg == "--frame-args" && i + 1 < argc) {
+            frameArgs = argv[++i];
+        } else if (arg == "--save" && i + 1 < argc) {
+            saveFile = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            baselineFile = argv[++i];
+        } else if (arg.rfind("--", 0) == 0) {
+            cout << "Unknown option: " << arg << endl;
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            scenes.push_back(arg);
+        }
+    }
+
+    vector<BenchResult> results;
+    if (micro) {
+        cout << "Microbenchmarks, " << benchRuns << " runs of ~" << runMs << " ms each..." << endl;
+        results = runMicrobenchmarks();
+    }
+    if (builds) {
+        cout << "Acceleration structure builds, " << benchRuns << " runs each:" << endl;
+        vector<BenchResult> buildResults = runBuildBenchmarks();
+        results.insert(results.end(), buildResults.begin(), buildResults.end());
+    }
+    if (frames) {
+        if (scenes.empty()) scenes = corpusScenes(corpus);
+        scenes.erase(remove_if(scenes.begin(), scenes.end(), [](const string& scene) {
+            return !selected("frame." + filesystem::path(scene).stem().string());
+        }), scenes.end());
+        if (scenes.empty()) cout << "No scene files to render (looked in " << corpus << ")" << endl;
+        else cout << "Full frames with " << headlessPath << ", " << benchRuns << " runs each:" << endl;
+        vector<BenchResult> frameResults = runFrameBenchmarks(scenes);
+        results.insert(results.end(), frameResults.begin(), frameResults.end());
+    }
+
+    map<string, BenchResult> baseline;
+    if (!baselineFile.empty()) {
+        baseline = loadResults(baselineFile);
+        if (baseline.empty()) cout << "Warning: no results in baseline " << baselineFile << endl;
+    }
+    printResults(results, baseline);
+    if (!saveFile.empty()) {
+        saveResults(results, saveFile);
+        cout << "\nResults saved to " << saveFile << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "budget.h"
+
+const char* qualityTierName(QualityTier tier) {
+    switch (tier) {
+        case TIER_PREVIEW: return "preview";
+        case TIER_FULL: return "full";
+        case TIER_ANTIALIASED: return "antialiased";
+        default: return "none";
+    }
+}
+
+// Radical inverse of n in the given base, for well spread sub-pixel offsets
+static double halton(int n, int base) {
+    double result = 0, f = 1.0 / base;
+    for (; n > 0; n /= base, f /= base) result += f * (n % base);
+    return result;
+}
+
+BudgetReport renderWithBudget(const Camera& camera, bitmap_image& image,
+                              std::chrono::steady_clock::time_point deadline,
+                              const RenderOptions& options, int maxSamples) {
+    BudgetReport report;
+    int width = image.width(), height = image.height();
+
+    // Only the speed settings carry over; caches and checkpoints assume a single pass
+    RenderOptions pass;
+    pass.hybrid = options.hybrid;
+    pass.threads = options.threads;
+    pass.tileOrder = options.tileOrder;
+    pass.pixelOrder = options.pixelOrder;
+    pass.stats = options.stats;
+    pass.deadline = &deadline;
+
+    // Preview pass, upscaled by pixel replication
+    bitmap_image preview((width + PREVIEW_SCALE - 1) / PREVIEW_SCALE, (height + PREVIEW_SCALE - 1) / PREVIEW_SCALE);
+    preview.set_all_channels(0, 0, 0);
+    bool finished = renderImage(camera, preview, pass);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            unsigned char r, g, b;
+            preview.get_pixel(i / PREVIEW_SCALE, j / PREVIEW_SCALE, r, g, b);
+            image.set_pixel(i, j, r, g, b);
+        }
+    }
+    if (!finished) return report;
+    report.tier = TIER_PREVIEW;
+
+    // Full resolution, then one more jittered sample per pass, all averaged in the sums
+    std::vector<Vector3D> sums(width * height, Vector3D(0, 0, 0));
+    pass.accumulation = &sums;
+    for (int sample = 0; sample < maxSamples; sample++) {
+        pass.accumulatedSamples = sample;
+        pass.jitterX = sample == 0 ? 0 : halton(sample, 2) - 0.5;
+        pass.jitterY = sample == 0 ? 0 : halton(sample, 3) - 0.5;
+        if (!renderImage(camera, image, pass)) break;
+
+        report.tier = sample == 0 ? TIER_FULL : TIER_ANTIALIASED;
+        report.samples = sample + 1;
+    }
+    return report;
+}
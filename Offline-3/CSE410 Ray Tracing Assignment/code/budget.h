@@ -0,0 +1,33 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <chrono>
+#include "renderer.h"
+
+// Quality reached by a time-budgeted render, lowest first
+enum QualityTier {
+    TIER_NONE,          // not even the preview finished
+    TIER_PREVIEW,       // low resolution pass, upscaled
+    TIER_FULL,          // one sample per pixel at full resolution
+    TIER_ANTIALIASED    // full resolution plus extra jittered samples
+};
+
+const char* qualityTierName(QualityTier tier);
+
+struct BudgetReport {
+    QualityTier tier = TIER_NONE;
+    int samples = 0;    // samples per pixel finished everywhere (0 below TIER_FULL)
+};
+
+// Resolution divisor of the preview pass
+const int PREVIEW_SCALE = 4;
+
+// Render coarse to fine until the deadline: a preview at 1/PREVIEW_SCALE resolution, the full
+// resolution pass, then jittered antialiasing passes up to maxSamples per pixel. A pass cut off
+// by the deadline has already replaced the tiles it finished, so the image is always the best
+// one so far. Uses the threads, hybrid, traversal and stats settings of options.
+BudgetReport renderWithBudget(const Camera& camera, bitmap_image& image,
+                              std::chrono::steady_clock::time_point deadline,
+                              const RenderOptions& options, int maxSamples = 16);
+
+#endif // BUDGET_H
@@ -0,0 +1,678 @@
+#include "bvh.h"
+#include "render_stats.h"
+#include "scene.h"
+#include "trace.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+AccelLayout accelLayout = ACCEL_QBVH4;
+BuildMethod accelBuild = BUILD_SAH;
+int accelBuildThreads = 1;
+SceneBVH sceneBVH;
+
+const char* accelLayoutName(AccelLayout layout) {
+    switch (layout) {
+        case ACCEL_BVH4: return "bvh4";
+        case ACCEL_QBVH4: return "qbvh4";
+        default: return "none";
+    }
+}
+
+bool parseAccelLayout(const std::string& name, AccelLayout& layout) {
+    if (name == "none") layout = ACCEL_NONE;
+    else if (name == "bvh4") layout = ACCEL_BVH4;
+    else if (name == "qbvh4") layout = ACCEL_QBVH4;
+    else return false;
+    return true;
+}
+
+const char* buildMethodName(BuildMethod method) {
+    return method == BUILD_LBVH ? "lbvh" : "sah";
+}
+
+bool parseBuildMethod(const std::string& name, BuildMethod& method) {
+    if (name == "sah") method = BUILD_SAH;
+    else if (name == "lbvh") method = BUILD_LBVH;
+    else return false;
+    return true;
+}
+
+void buildAccel() {
+    sceneBVH.build(accelLayout, accelBuild, accelBuildThreads);
+}
+
+// ---- Build ----
+
+namespace {
+
+// Bounds as plain arrays; the build grows millions of these, so they have to be cheap
+struct Box {
+    double lo[3] = {INFINITY, INFINITY, INFINITY};
+    double hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+    Box() {}
+    explicit Box(const Bounds& b) : lo{b.min.x, b.min.y, b.min.z}, hi{b.max.x, b.max.y, b.max.z} {}
+
+    void grow(const double* p) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], p[a]);
+            hi[a] = std::max(hi[a], p[a]);
+        }
+    }
+    void grow(const Box& b) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], b.lo[a]);
+            hi[a] = std::max(hi[a], b.hi[a]);
+        }
+    }
+    double area() const {
+        double dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+        return dx < 0 ? 0 : 2 * (dx * dy + dy * dz + dz * dx);
+    }
+};
+
+struct BuildPrim {
+    Box box;
+    double centroid[3];
+    int index;
+    uint64_t code;          // Morton code of the centroid (LBVH builds only)
+};
+
+// Node with up to four children before it is encoded in one of the layouts
+struct WideNode {
+    Box box[4];
+    int32_t child[4];
+    int count = 0;
+};
+
+// Subtree left for a worker: prims[begin, end) goes under slot 'slot' of node 'parent',
+// its root 'depth' levels below the tree's
+struct Subtree {
+    int parent, slot, begin, end, depth;
+};
+
+// Levels of inner nodes a tree may have; traversal stacks are sized for it
+const int MAX_TREE_DEPTH = 64;
+// Below this depth ranges are split at the centroid median, which quarters them every level;
+// the 16 levels left take 4^16 * LEAF_SIZE = 2^34 primitives, well past MAX_PRIMITIVES
+const int MEDIAN_SPLIT_DEPTH = MAX_TREE_DEPTH - 16;
+
+// Top-down builder over a shared prims array. Builders working on disjoint ranges of it can
+// run in parallel, each filling its own node list.
+class Builder {
+public:
+    Builder(std::vector<BuildPrim>& prims, BuildMethod method) : prims(prims), method(method) {}
+
+    std::vector<WideNode> nodes;
+    int deferBelow = 0;             // ranges smaller than this go to 'deferred' instead of being built
+    std::vector<Subtree> deferred;
+
+    // Build the subtree over prims[begin, end) with its root 'depth' levels down and return
+    // the root node
+    int buildNode(int begin, int end, int depth) {
+        int index = nodes.size();
+        nodes.emplace_back();
+
+        // Split the largest range in two until there are four or none can be split
+        std::vector<std::pair<int, int>> ranges = {{begin, end}};
+        while (ranges.size() < 4) {
+            int largest = -1;
+            for (int r = 0; r < (int)ranges.size(); r++) {
+                int size = ranges[r].second - ranges[r].first;
+                if (size > SceneBVH::LEAF_SIZE && (largest < 0 || size > ranges[largest].second - ranges[largest].first)) {
+                    largest = r;
+                }
+            }
+            if (largest < 0) break;
+            int first = ranges[largest].first, last = ranges[largest].second;
+            int middle = depth >= MEDIAN_SPLIT_DEPTH ? splitMedian(first, last) : split(first, last);
+            ranges[largest] = {first, middle};
+            ranges.push_back({middle, last});
+        }
+
+        for (auto& range : ranges) {
+            Box box;
+            for (int k = range.first; k < range.second; k++) box.grow(prims[k].box);
+            int count = range.second - range.first;
+            int32_t child;
+            if (count <= SceneBVH::LEAF_SIZE) {
+                child = SceneBVH::leafRef(range.first, count);
+            } else if (count < deferBelow) {
+                deferred.push_back(Subtree{index, nodes[index].count, range.first, range.second, depth + 1});
+                child = 0;          // patched when the subtree is spliced in
+            } else {
+                child = buildNode(range.first, range.second, depth + 1);
+            }
+            WideNode& node = nodes[index];
+            node.box[node.count] = box;
+            node.child[node.count] = child;
+            node.count++;
+        }
+        return index;
+    }
+
+private:
+    std::vector<BuildPrim>& prims;
+    BuildMethod method;
+
+    // Split prims[begin, end) in two non-empty parts; returns where the second starts
+    int split(int begin, int end) {
+        int middle = method == BUILD_LBVH ? splitMorton(begin, end) : splitSah(begin, end);
+        return middle > begin && middle < end ? middle : splitMedian(begin, end);
+    }
+
+    // Centroid median along the longest axis
+    int splitMedian(int begin, int end) {
+        Box centroids;
+        for (int k = begin; k < end; k++) centroids.grow(prims[k].centroid);
+        int axis = 0;
+        for (int a = 1; a < 3; a++) {
+            if (centroids.hi[a] - centroids.lo[a] > centroids.hi[axis] - centroids.lo[axis]) axis = a;
+        }
+        int middle = (begin + end) / 2;
+        std::nth_element(prims.begin() + begin, prims.begin() + middle, prims.begin() + end,
+                         [axis](const BuildPrim& a, const BuildPrim& b) { return a.centroid[axis] < b.centroid[axis]; });
+        return middle;
+    }
+
+    // Binned surface area heuristic: centroids are binned along each axis in one pass, and the
+    // bin boundary minimizing area(left) * count(left) + area(right) * count(right) wins
+    int splitSah(int begin, int end) {
+        const int BINS = 16;
+        Box centroids;
+        for (int k = begin; k < end; k++) centroids.grow(prims[k].centroid);
+        double scale[3];
+        for (int a = 0; a < 3; a++) {
+            double extent = centroids.hi[a] - centroids.lo[a];
+            scale[a] = extent > 0 ? BINS / extent : 0;
+        }
+        auto binOf = [&](const BuildPrim& prim, int a) {
+            return std::min(BINS - 1, (int)((prim.centroid[a] - centroids.lo[a]) * scale[a]));
+        };
+
+        Box binBox[3][BINS];
+        int binCount[3][BINS] = {};
+        for (int k = begin; k < end; k++) {
+            for (int a = 0; a < 3; a++) {
+                int bin = binOf(prims[k], a);
+                binCount[a][bin]++;
+                binBox[a][bin].grow(prims[k].box);
+            }
+        }
+
+        double bestCost = INFINITY;
+        int bestAxis = -1, bestBin = 0;
+        for (int a = 0; a < 3; a++) {
+            if (scale[a] == 0) continue;
+            // Cost of everything right of each boundary, then sweep from the left
+            double rightCost[BINS];
+            Box side;
+            int count = 0;
+            for (int b = BINS - 1; b > 0; b--) {
+                side.grow(binBox[a][b]);
+                count += binCount[a][b];
+                rightCost[b] = side.area() * count;
+            }
+            side = Box();
+            count = 0;
+            for (int b = 0; b < BINS - 1; b++) {
+                side.grow(binBox[a][b]);
+                count += binCount[a][b];
+                double cost = side.area() * count + rightCost[b + 1];
+                if (count > 0 && count < end - begin && cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = a;
+                    bestBin = b;
+                }
+            }
+        }
+        if (bestAxis < 0) return begin;     // all centroids coincide
+
+        auto middle = std::partition(prims.begin() + begin, prims.begin() + end,
+                                     [&](const BuildPrim& prim) { return binOf(prim, bestAxis) <= bestBin; });
+        return middle - prims.begin();
+    }
+
+    // Prims sorted by Morton code split where the highest differing bit of the range flips
+    int splitMorton(int begin, int end) {
+        uint64_t diff = prims[begin].code ^ prims[end - 1].code;
+        if (diff == 0) return begin;
+        int bit = 63;
+        while (!(diff >> bit)) bit--;
+        auto middle = std::partition_point(prims.begin() + begin, prims.begin() + end,
+                                           [bit](const BuildPrim& prim) { return !((prim.code >> bit) & 1); });
+        return middle - prims.begin();
+    }
+};
+
+// Float bounds that contain the double ones
+float roundDown(double v) { return std::nextafter((float)v, -INFINITY); }
+float roundUp(double v) { return std::nextafter((float)v, INFINITY); }
+
+void encode(const WideNode& wide, BVHNode4& node) {
+    for (int k = 0; k < 4; k++) {
+        bool used = k < wide.count;
+        for (int a = 0; a < 3; a++) {
+            // Unused slots get an inverted box no ray can hit
+            node.lower[a][k] = used ? roundDown(wide.box[k].lo[a]) : INFINITY;
+            node.upper[a][k] = used ? roundUp(wide.box[k].hi[a]) : -INFINITY;
+        }
+        node.child[k] = used ? wide.child[k] : SceneBVH::EMPTY;
+    }
+}
+
+void encode(const WideNode& wide, QuantizedNode4& node) {
+    Box box;
+    for (int k = 0; k < wide.count; k++) box.grow(wide.box[k]);
+
+    for (int a = 0; a < 3; a++) {
+        // Grid of 255 steps over the node's box, widened until its last line covers the box
+        float origin = roundDown(box.lo[a]);
+        float top = roundUp(box.hi[a]);
+        float scale = std::max((top - origin) / 255.0f, 1e-30f);
+        while (origin + 255.0f * scale < top) scale = std::nextafter(scale, INFINITY);
+        node.origin[a] = origin;
+        node.scale[a] = scale;
+
+        for (int k = 0; k < 4; k++) {
+            if (k >= wide.count) {
+                node.lower[a][k] = 255;
+                node.upper[a][k] = 0;
+                continue;
+            }
+            // Round outwards, then correct for float rounding so the decoded box still contains the child
+            double lo = wide.box[k].lo[a], hi = wide.box[k].hi[a];
+            int qlo = std::max(0, std::min(255, (int)std::floor((lo - origin) / scale)));
+            int qhi = std::max(0, std::min(255, (int)std::ceil((hi - origin) / scale)));
+            while (qlo > 0 && origin + qlo * scale > lo) qlo--;
+            while (qhi < 255 && origin + qhi * scale < hi) qhi++;
+            node.lower[a][k] = qlo;
+            node.upper[a][k] = qhi;
+        }
+    }
+    for (int k = 0; k < 4; k++) node.child[k] = k < wide.count ? wide.child[k] : SceneBVH::EMPTY;
+}
+
+} // namespace
+
+void SceneBVH::clear() {
+    buildSeconds = 0;
+    nodes.clear();
+    quantized.clear();
+    primitives.clear();
+    unbounded.clear();
+    layout = ACCEL_NONE;
+    objectCount = -1;
+}
+
+void SceneBVH::build(AccelLayout newLayout, BuildMethod method, int threads) {
+    TraceScope span("accel build", "load", "objects", objects.size());
+    auto start = std::chrono::steady_clock::now();
+    clear();
+    if (newLayout == ACCEL_NONE) return;
+
+    std::vector<BuildPrim> prims;
+    Bounds sceneBox, centroids;
+    for (int k = 0; k < (int)objects.size(); k++) {
+        Bounds box = objects[k]->getBounds();
+        if (!box.isFinite() || box.isEmpty()) {
+            unbounded.push_back(k);
+            continue;
+        }
+        Vector3D center = box.center();
+        prims.push_back(BuildPrim{Box(box), {center.x, center.y, center.z}, k, 0});
+        sceneBox.extend(box);
+        centroids.extend(box.center());
+    }
+    if ((int64_t)prims.size() > MAX_PRIMITIVES) {
+        // Leaf references can't address them; every ray tests every object instead
+        printf("Warning: %d bounded objects is more than the %d a BVH can hold; rendering without one\n",
+               (int)prims.size(), MAX_PRIMITIVES);
+        unbounded.clear();
+        return;
+    }
+
+    Builder top(prims, method);
+    std::vector<Builder> subtrees;
+    if (!prims.empty()) {
+        // Boxes are padded a little so rays tested in float precision never miss a true hit
+        Vector3D extent = sceneBox.max - sceneBox.min;
+        double reach = std::max({extent.x, extent.y, extent.z, std::fabs(sceneBox.min.x), std::fabs(sceneBox.min.y),
+                                 std::fabs(sceneBox.min.z), std::fabs(sceneBox.max.x), std::fabs(sceneBox.max.y),
+                                 std::fabs(sceneBox.max.z)});
+        double pad = reach * 1e-5 + 1e-9;
+        for (BuildPrim& prim : prims) {
+            for (int a = 0; a < 3; a++) {
+                prim.box.lo[a] -= pad;
+                prim.box.hi[a] += pad;
+            }
+        }
+
+        if (method == BUILD_LBVH) {
+            for (BuildPrim& prim : prims) {
+                prim.code = mortonKey(Vector3D(prim.centroid[0], prim.centroid[1], prim.centroid[2]), centroids);
+            }
+            std::sort(prims.begin(), prims.end(), [](const BuildPrim& a, const BuildPrim& b) { return a.code < b.code; });
+        }
+
+        // The top levels are built here; subtrees below a size that gives every thread several
+        // of them are built in parallel, each into its own node list
+        threads = std::max(1, threads);
+        if (threads > 1) top.deferBelow = std::max(4096, (int)prims.size() / (threads * 8));
+        top.buildNode(0, prims.size(), 0);
+
+        subtrees.reserve(top.deferred.size());
+        for (size_t t = 0; t < top.deferred.size(); t++) subtrees.emplace_back(prims, method);
+        std::atomic<int> next(0);
+        auto worker = [&]() {
+            for (int t = next++; t < (int)subtrees.size(); t = next++) {
+                TraceScope subtreeSpan("accel subtree", "load", "primitives", top.deferred[t].end - top.deferred[t].begin);
+                subtrees[t].buildNode(top.deferred[t].begin, top.deferred[t].end, top.deferred[t].depth);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (int t = 1; t < std::min(threads, (int)subtrees.size()); t++) workers.emplace_back(worker);
+        worker();
+        for (std::thread& t : workers) t.join();
+
+        // Splice the subtrees in after the top levels
+        for (int t = 0; t < (int)subtrees.size(); t++) {
+            int offset = top.nodes.size();
+            for (WideNode& node : subtrees[t].nodes) {
+                for (int k = 0; k < node.count; k++) {
+                    if (node.child[k] >= 0) node.child[k] += offset;
+                }
+                top.nodes.push_back(node);
+            }
+            top.nodes[top.deferred[t].parent].child[top.deferred[t].slot] = offset;
+        }
+    }
+
+    for (const BuildPrim& prim : prims) primitives.push_back(prim.index);
+    if (newLayout == ACCEL_BVH4) {
+        nodes.resize(top.nodes.size());
+        for (int n = 0; n < (int)nodes.size(); n++) encode(top.nodes[n], nodes[n]);
+    } else {
+        quantized.resize(top.nodes.size());
+        for (int n = 0; n < (int)quantized.size(); n++) encode(top.nodes[n], quantized[n]);
+    }
+    layout = newLayout;
+    buildMethod = method;
+    buildThreads = threads;
+    objectCount = objects.size();
+    buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+size_t SceneBVH::nodeBytes() const {
+    return nodes.size() * sizeof(BVHNode4) + quantized.size() * sizeof(QuantizedNode4)
+           + primitives.size() * sizeof(int);
+}
+
+// ---- Traversal ----
+
+namespace {
+
+// Ray in the float form the box tests use
+struct BoxRay {
+    float origin[3], inverse[3];
+    bool negative[3];
+
+    explicit BoxRay(const Ray& ray) {
+        double dir[3] = {ray.dir.x, ray.dir.y, ray.dir.z}, start[3] = {ray.start.x, ray.start.y, ray.start.z};
+        for (int a = 0; a < 3; a++) {
+            origin[a] = start[a];
+            inverse[a] = 1.0f / (float)dir[a];
+            negative[a] = std::signbit(inverse[a]);
+        }
+    }
+};
+
+// Slab test of one ray against four child boxes. Returns a bit per child whose box the ray
+// enters within [0, tMax] and writes the entry distances to tNear. NaNs from 0 * inf (ray in a
+// slab plane) are dropped by the min/max order, which keeps the test conservative.
+#ifdef __SSE2__
+inline int slabTest(const __m128 lower[3], const __m128 upper[3], const BoxRay& ray, float tMax, float* tNear) {
+    __m128 enter = _mm_setzero_ps(), leave = _mm_set1_ps(tMax);
+    for (int a = 0; a < 3; a++) {
+        __m128 origin = _mm_set1_ps(ray.origin[a]), inverse = _mm_set1_ps(ray.inverse[a]);
+        __m128 nearPlane = ray.negative[a] ? upper[a] : lower[a];
+        __m128 farPlane = ray.negative[a] ? lower[a] : upper[a];
+        enter = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(nearPlane, origin), inverse), enter);
+        leave = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(farPlane, origin), inverse), leave);
+    }
+    _mm_storeu_ps(tNear, enter);
+    return _mm_movemask_ps(_mm_cmple_ps(enter, leave));
+}
+
+inline int childTest(const BVHNode4& node, const BoxRay& ray, float tMax, float* tNear) {
+    __m128 lower[3], upper[3];
+    for (int a = 0; a < 3; a++) {
+        lower[a] = _mm_load_ps(node.lower[a]);
+        upper[a] = _mm_load_ps(node.upper[a]);
+    }
+    return slabTest(lower, upper, ray, tMax, tNear);
+}
+
+// Four 8-bit grid coordinates as floats
+inline __m128 unpackBytes(const uint8_t* bytes) {
+    int32_t packed;
+    std::memcpy(&packed, bytes, 4);
+    __m128i zero = _mm_setzero_si128();
+    __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+inline int childTest(const QuantizedNode4& node, const BoxRay& ray, float tMax, float* tNear) {
+    __m128 lower[3], upper[3];
+    for (int a = 0; a < 3; a++) {
+        __m128 origin = _mm_set1_ps(node.origin[a]), scale = _mm_set1_ps(node.scale[a]);
+        lower[a] = _mm_add_ps(origin, _mm_mul_ps(unpackBytes(node.lower[a]), scale));
+        upper[a] = _mm_add_ps(origin, _mm_mul_ps(unpackBytes(node.upper[a]), scale));
+    }
+    return slabTest(lower, upper, ray, tMax, tNear);
+}
+#else
+// Portable version of the same test, lane by lane
+inline int slabTest(const float lower[3][4], const float upper[3][4], const BoxRay& ray, float tMax, float* tNear) {
+    int mask = 0;
+    for (int k = 0; k < 4; k++) {
+        float enter = 0, leave = tMax;
+        for (int a = 0; a < 3; a++) {
+            float nearT = ((ray.negative[a] ? upper[a][k] : lower[a][k]) - ray.origin[a]) * ray.inverse[a];
+            float farT = ((ray.negative[a] ? lower[a][k] : upper[a][k]) - ray.origin[a]) * ray.inverse[a];
+            enter = nearT > enter ? nearT : enter;
+            leave = farT < leave ? farT : leave;
+        }
+        tNear[k] = enter;
+        if (enter <= leave) mask |= 1 << k;
+    }
+    return mask;
+}
+
+inline int childTest(const BVHNode4& node, const BoxRay& ray, float tMax, float* tNear) {
+    return slabTest(node.lower, node.upper, ray, tMax, tNear);
+}
+
+inline int childTest(const QuantizedNode4& node, const BoxRay& ray, float tMax, float* tNear) {
+    float lower[3][4], upper[3][4];
+    for (int a = 0; a < 3; a++) {
+        for (int k = 0; k < 4; k++) {
+            lower[a][k] = node.origin[a] + node.lower[a][k] * node.scale[a];
+            upper[a][k] = node.origin[a] + node.upper[a][k] * node.scale[a];
+        }
+    }
+    return slabTest(lower, upper, ray, tMax, tNear);
+}
+#endif
+
+// Child k's box, decoded the same way the ray tests decode it
+inline Bounds childBounds(const BVHNode4& node, int k) {
+    return Bounds(Vector3D(node.lower[0][k], node.lower[1][k], node.lower[2][k]),
+                  Vector3D(node.upper[0][k], node.upper[1][k], node.upper[2][k]));
+}
+
+inline Bounds childBounds(const QuantizedNode4& node, int k) {
+    float lower[3], upper[3];
+    for (int a = 0; a < 3; a++) {
+        lower[a] = node.origin[a] + node.lower[a][k] * node.scale[a];
+        upper[a] = node.origin[a] + node.upper[a][k] * node.scale[a];
+    }
+    return Bounds(Vector3D(lower[0], lower[1], lower[2]), Vector3D(upper[0], upper[1], upper[2]));
+}
+
+// Each step pops one entry and pushes at most four, so a tree of depth D never holds more than
+// 3 * D + 1; the builder keeps trees within MAX_TREE_DEPTH levels
+const int STACK_SIZE = 256;
+static_assert(STACK_SIZE >= 3 * MAX_TREE_DEPTH + 1, "traversal stack too small for the deepest tree");
+
+struct StackEntry {
+    int32_t ref;
+    float tNear;
+};
+
+} // namespace
+
+template <class Node>
+int SceneBVH::nearestIn(const std::vector<Node>& tree, Ray* ray, double& tMin,
+                        const std::vector<char>* include) const {
+    tMin = -1;
+    int nearest = -1;
+    auto test = [&](int k) {
+        if (include && !(*include)[k]) return;
+        rayCounters.primitiveTests++;
+        double t = objects[k]->intersect(ray, nullptr, 0);
+        if (t > 0 && (tMin < 0 || t < tMin || (t == tMin && k < nearest))) {
+            tMin = t;
+            nearest = k;
+        }
+    };
+    for (int k : unbounded) test(k);
+    if (tree.empty()) return nearest;
+
+    BoxRay boxRay(*ray);
+    StackEntry stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = {0, 0.0f};
+    while (top > 0) {
+        StackEntry entry = stack[--top];
+        // Slightly past the best hit, so boxes the float test puts just behind it still get visited
+        float tMax = tMin < 0 ? INFINITY : (float)tMin * 1.0001f + 1e-6f;
+        if (entry.tNear > tMax) continue;
+        if (entry.ref < 0) {
+            for (int p = leafFirst(entry.ref), end = p + leafCount(entry.ref); p < end; p++) test(primitives[p]);
+            continue;
+        }
+
+        rayCounters.nodeVisits++;
+        const Node& node = tree[entry.ref];
+        float tNear[4];
+        int mask = childTest(node, boxRay, tMax, tNear);
+
+        // Push the children that were hit far to near, so the nearest is visited first
+        StackEntry hits[4];
+        int count = 0;
+        for (int k = 0; k < 4; k++) {
+            if (!(mask & (1 << k)) || node.child[k] == EMPTY) continue;
+            int slot = count++;
+            while (slot > 0 && hits[slot - 1].tNear < tNear[k]) {
+                hits[slot] = hits[slot - 1];
+                slot--;
+            }
+            hits[slot] = {node.child[k], tNear[k]};
+        }
+        for (int k = 0; k < count; k++) stack[top++] = hits[k];
+    }
+    return nearest;
+}
+
+template <class Node>
+int SceneBVH::anyHitIn(const std::vector<Node>& tree, Ray* ray, const Object* self) const {
+    auto blocks = [&](int k) {
+        if (objects[k] == self) return false;
+        rayCounters.primitiveTests++;
+        return objects[k]->intersect(ray, nullptr, 0) > 0;
+    };
+    for (int k : unbounded) {
+        if (blocks(k)) return k;
+    }
+    if (tree.empty()) return -1;
+
+    BoxRay boxRay(*ray);
+    int32_t stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        int32_t ref = stack[--top];
+        if (ref < 0) {
+            for (int p = leafFirst(ref), end = p + leafCount(ref); p < end; p++) {
+                if (blocks(primitives[p])) return primitives[p];
+            }
+            continue;
+        }
+
+        rayCounters.nodeVisits++;
+        const Node& node = tree[ref];
+        float tNear[4];
+        int mask = childTest(node, boxRay, INFINITY, tNear);
+        for (int k = 0; k < 4; k++) {
+            if ((mask & (1 << k)) && node.child[k] != EMPTY) stack[top++] = node.child[k];
+        }
+    }
+    return -1;
+}
+
+template <class Node>
+bool SceneBVH::collectIn(const std::vector<Node>& tree, const std::function<bool(const Bounds&)>& overlaps,
+                         const std::function<bool(int)>& keep, int limit, std::vector<int>& found) const {
+    found.clear();
+    for (int k : unbounded) {
+        if (keep(k)) found.push_back(k);
+    }
+    if ((int)found.size() > limit) return false;
+    if (tree.empty()) return true;
+
+    int32_t stack[STACK_SIZE];
+    int top = 0, opened = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        int32_t ref = stack[--top];
+        if (ref < 0) {
+            for (int p = leafFirst(ref), end = p + leafCount(ref); p < end; p++) {
+                if (!keep(primitives[p])) continue;
+                found.push_back(primitives[p]);
+                if ((int)found.size() > limit) return false;
+            }
+            continue;
+        }
+
+        if (++opened > 2 * limit) return false;
+        const Node& node = tree[ref];
+        for (int k = 0; k < 4; k++) {
+            if (node.child[k] != EMPTY && overlaps(childBounds(node, k))) stack[top++] = node.child[k];
+        }
+    }
+    std::sort(found.begin(), found.end());
+    return true;
+}
+
+int SceneBVH::nearest(Ray* ray, double& tMin, const std::vector<char>* include) const {
+    return layout == ACCEL_QBVH4 ? nearestIn(quantized, ray, tMin, include) : nearestIn(nodes, ray, tMin, include);
+}
+
+int SceneBVH::anyHit(Ray* ray, const Object* self) const {
+    return layout == ACCEL_QBVH4 ? anyHitIn(quantized, ray, self) : anyHitIn(nodes, ray, self);
+}
+
+bool SceneBVH::collect(const std::function<bool(const Bounds&)>& overlaps, const std::function<bool(int)>& keep,
+                       int limit, std::vector<int>& found) const {
+    return layout == ACCEL_QBVH4 ? collectIn(quantized, overlaps, keep, limit, found)
+                                 : collectIn(nodes, overlaps, keep, limit, found);
+}
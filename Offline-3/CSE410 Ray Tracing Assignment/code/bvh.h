@@ -0,0 +1,111 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "2005062_classes.h"
+
+// Node layout of the acceleration structure over objects
+enum AccelLayout {
+    ACCEL_NONE,     // test every object for every ray
+    ACCEL_BVH4,     // 4-wide BVH, child boxes as floats
+    ACCEL_QBVH4     // 4-wide BVH, child boxes quantized to 8 bits inside the node's box
+};
+
+const char* accelLayoutName(AccelLayout layout);
+// Parse "none", "bvh4" or "qbvh4"; false for anything else
+bool parseAccelLayout(const std::string& name, AccelLayout& layout);
+
+// How the tree is split
+enum BuildMethod {
+    BUILD_SAH,      // binned surface area heuristic; slower to build, faster to trace
+    BUILD_LBVH      // split on Morton code bits of sorted centroids; for quick rebuilds
+};
+
+const char* buildMethodName(BuildMethod method);
+// Parse "sah" or "lbvh"; false for anything else
+bool parseBuildMethod(const std::string& name, BuildMethod& method);
+
+// Child boxes of a node in structure-of-arrays form, one SIMD lane per child.
+// child[k] >= 0 is an inner node, a negative value a leaf (see SceneBVH), EMPTY an unused slot.
+struct alignas(16) BVHNode4 {
+    float lower[3][4], upper[3][4];
+    int32_t child[4];
+};
+
+// Same, with child bounds stored as origin + q * scale for 8-bit q; 64 bytes, one cache line
+struct alignas(16) QuantizedNode4 {
+    float origin[3], scale[3];
+    uint8_t lower[3][4], upper[3][4];
+    int32_t child[4];
+};
+
+// 4-wide bounding volume hierarchy over objects, answering the renderer's closest-hit and
+// shadow queries. Objects with unbounded extents are kept aside and tested by every ray.
+class SceneBVH {
+public:
+    static const int LEAF_SIZE = 4;         // most objects in one leaf
+    static const int32_t EMPTY = INT32_MIN;
+    // Most bounded objects a tree is built over; leaf references have 27 bits for the offset
+    static const int MAX_PRIMITIVES = 1 << 27;
+
+    // Build over the current objects in the given layout; ACCEL_NONE just clears, as does a
+    // scene with more than MAX_PRIMITIVES bounded objects. Subtrees are built on up to
+    // 'threads' threads.
+    void build(AccelLayout layout, BuildMethod method = BUILD_SAH, int threads = 1);
+    void clear();
+
+    // True if built for the current objects
+    bool usable() const { return layout != ACCEL_NONE && objectCount == (int)objects.size(); }
+
+    // Same contract as the linear findNearestObject: nearest object with t > 0, ties to the
+    // lowest index. With include, only objects k with (*include)[k] set are tested.
+    int nearest(Ray* ray, double& tMin, const std::vector<char>* include = nullptr) const;
+    // Some object other than self hit at t > 0, or -1
+    int anyHit(Ray* ray, const Object* self) const;
+    // Objects some volume may touch: those 'keep' accepts among the unbounded ones and in leaves
+    // reached through boxes 'overlaps' accepts; ascending. Gives up and returns false once more
+    // than 'limit' are found or 2 * limit nodes have been opened.
+    bool collect(const std::function<bool(const Bounds&)>& overlaps, const std::function<bool(int)>& keep,
+                 int limit, std::vector<int>& found) const;
+
+    AccelLayout layout = ACCEL_NONE;
+    BuildMethod buildMethod = BUILD_SAH;
+    int buildThreads = 1;
+    double buildSeconds = 0;                // time the last build took
+    int nodeCount() const { return layout == ACCEL_QBVH4 ? quantized.size() : nodes.size(); }
+    size_t nodeBytes() const;               // nodes plus the leaves' object index lists
+    int boundedCount() const { return primitives.size(); }
+
+    // Leaves are stored as ~(first << 4 | (count - 1)), first being their offset in primitives;
+    // first < MAX_PRIMITIVES keeps the shift inside a positive int32
+    static int32_t leafRef(int first, int count) { return ~((first << 4) | (count - 1)); }
+    static int leafFirst(int32_t ref) { return ~ref >> 4; }
+    static int leafCount(int32_t ref) { return (~ref & 15) + 1; }
+
+private:
+    template <class Node> int nearestIn(const std::vector<Node>& tree, Ray* ray, double& tMin,
+                                        const std::vector<char>* include) const;
+    template <class Node> int anyHitIn(const std::vector<Node>& tree, Ray* ray, const Object* self) const;
+    template <class Node> bool collectIn(const std::vector<Node>& tree, const std::function<bool(const Bounds&)>& overlaps,
+                                         const std::function<bool(int)>& keep, int limit, std::vector<int>& found) const;
+
+    std::vector<BVHNode4> nodes;
+    std::vector<QuantizedNode4> quantized;
+    std::vector<int> primitives;            // object indices, grouped by leaf
+    std::vector<int> unbounded;
+    int objectCount = -1;
+};
+
+// Settings buildAccel uses: quantized layout and SAH splits on one thread by default
+extern AccelLayout accelLayout;
+extern BuildMethod accelBuild;
+extern int accelBuildThreads;
+extern SceneBVH sceneBVH;
+
+// (Re)build sceneBVH over objects; call after objects are added, removed or moved
+void buildAccel();
+
+#endif // BVH_H
@@ -0,0 +1,184 @@
+#include "checkpoint.h"
+#include <cstring>
+#include <algorithm>
+
+static const uint32_t CHECKPOINT_VERSION = 2;
+
+void Checkpoint::tileRect(int tile, int& x0, int& y0, int& x1, int& y1) const {
+    x0 = (tile % tilesX) * tileSize;
+    y0 = (tile / tilesX) * tileSize;
+    x1 = std::min(width, x0 + tileSize);
+    y1 = std::min(height, y0 + tileSize);
+}
+
+Checkpoint::Header Checkpoint::makeHeader() const {
+    Header header;
+    memcpy(header.magic, "RTCK", 4);
+    header.version = CHECKPOINT_VERSION;
+    header.jobKey = jobKey;
+    header.width = width;
+    header.height = height;
+    header.tileSize = tileSize;
+    header.floatColor = floatColor;
+    return header;
+}
+
+// Copy the valid records of an old checkpoint into 'to', restoring their pixels on the way
+bool Checkpoint::loadInto(const std::string& from, FILE* to, bitmap_image& image, std::vector<Vector3D>* hdr) {
+    FILE* in = fopen(from.c_str(), "rb");
+    if (!in) return false;
+
+    Header expected = makeHeader(), header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(&header, &expected, sizeof(header)) != 0) {
+        fclose(in);
+        return false;
+    }
+
+    std::vector<unsigned char> data;
+    int32_t record[2];  // tile index, sample count
+    size_t channelSize = floatColor ? sizeof(float) : 1;
+    while (fread(record, sizeof(record), 1, in) == 1) {
+        int tile = record[0], samples = record[1];
+        if (tile < 0 || tile >= (int)done.size() || samples <= 0) break;
+
+        int x0, y0, x1, y1;
+        tileRect(tile, x0, y0, x1, y1);
+        data.resize((x1 - x0) * (y1 - y0) * 3 * channelSize);
+        if (fread(data.data(), 1, data.size(), in) != data.size()) break; // truncated
+
+        const float* c = reinterpret_cast<const float*>(data.data());
+        const unsigned char* rgb = data.data();
+        for (int j = y0; j < y1; j++) {
+            for (int i = x0; i < x1; i++, c += 3, rgb += 3) {
+                if (!floatColor) {
+                    image.set_pixel(i, j, rgb[0], rgb[1], rgb[2]);
+                    continue;
+                }
+                Vector3D color = Vector3D(c[0], c[1], c[2]) * (1.0 / samples);
+                writePixel(image, i, j, color);
+                if (hdr) (*hdr)[j * width + i] = color;
+            }
+        }
+        done[tile] = 1;
+        fwrite(record, sizeof(record), 1, to);
+        fwrite(data.data(), 1, data.size(), to);
+    }
+    fclose(in);
+    return true;
+}
+
+bool Checkpoint::open(const std::string& filePath, uint64_t key, bitmap_image& image, int size, bool resume,
+                      std::vector<Vector3D>* hdr) {
+    close();
+    path = filePath;
+    jobKey = key;
+    floatColor = hdr != nullptr;
+    width = image.width();
+    height = image.height();
+    tileSize = size;
+    tilesX = (width + tileSize - 1) / tileSize;
+    tilesY = (height + tileSize - 1) / tileSize;
+    done.assign(tilesX * tilesY, 0);
+
+    // Rewrite the checkpoint so a truncated record from the last run doesn't end up mid-file
+    std::string temp = path + ".tmp";
+    if (resume) {
+        // Where rename can't replace a file, a run killed between removing the old checkpoint
+        // and renaming the new one leaves only the temp file; it is complete, so take it back
+        FILE* existing = fopen(path.c_str(), "rb");
+        if (existing) fclose(existing);
+        else std::rename(temp.c_str(), path.c_str());
+    }
+    FILE* out = fopen(temp.c_str(), "wb");
+    if (!out) return false;
+    Header header = makeHeader();
+    fwrite(&header, sizeof(header), 1, out);
+    if (resume && !loadInto(path, out, image, hdr)) {
+        printf("No matching checkpoint in %s, starting from scratch\n", path.c_str());
+    }
+    bool written = fclose(out) == 0;
+
+#ifdef _WIN32
+    // Windows' rename fails on an existing target; POSIX replaces it atomically, so a kill
+    // there always leaves one complete checkpoint at path
+    std::remove(path.c_str());
+#endif
+    if (!written || std::rename(temp.c_str(), path.c_str()) != 0) return false;
+
+    file = fopen(path.c_str(), "ab");
+    lastFlush = std::chrono::steady_clock::now();
+    return file != nullptr;
+}
+
+bool Checkpoint::holdsJob(const std::string& path, uint64_t jobKey, const bitmap_image& image, int tileSize,
+                          bool hdr) {
+    Checkpoint probe;
+    probe.jobKey = jobKey;
+    probe.floatColor = hdr;
+    probe.width = image.width();
+    probe.height = image.height();
+    probe.tileSize = tileSize;
+
+    FILE* in = fopen(path.c_str(), "rb");
+    if (!in) return false;
+    Header expected = probe.makeHeader(), header;
+    bool same = fread(&header, sizeof(header), 1, in) == 1 && memcmp(&header, &expected, sizeof(header)) == 0;
+    fclose(in);
+    return same;
+}
+
+int Checkpoint::doneCount() const {
+    return std::count(done.begin(), done.end(), 1);
+}
+
+void Checkpoint::tileFinished(int tile, const std::vector<Vector3D>& colors, int samples) {
+    // Convert outside the lock; workers only serialize on the write itself
+    std::vector<float> data;
+    std::vector<unsigned char> rgb;
+    if (floatColor) {
+        data.resize(colors.size() * 3);
+        for (int p = 0; p < (int)colors.size(); p++) {
+            data[p * 3] = colors[p].x;
+            data[p * 3 + 1] = colors[p].y;
+            data[p * 3 + 2] = colors[p].z;
+        }
+    } else {
+        // The bytes writePixel puts in the image, so a resumed tile matches it exactly
+        rgb.resize(colors.size() * 3);
+        for (int p = 0; p < (int)colors.size(); p++) {
+            Vector3D color = colors[p] * (1.0 / samples);
+            rgb[p * 3] = (unsigned char)(clamp(color.x, 0.0, 1.0) * 255);
+            rgb[p * 3 + 1] = (unsigned char)(clamp(color.y, 0.0, 1.0) * 255);
+            rgb[p * 3 + 2] = (unsigned char)(clamp(color.z, 0.0, 1.0) * 255);
+        }
+    }
+    int32_t record[2] = {tile, samples};
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return;
+    fwrite(record, sizeof(record), 1, file);
+    if (floatColor) fwrite(data.data(), sizeof(float), data.size(), file);
+    else fwrite(rgb.data(), 1, rgb.size(), file);
+
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - lastFlush).count() >= flushInterval) {
+        fflush(file);
+        lastFlush = now;
+    }
+}
+
+void Checkpoint::flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file) fflush(file);
+}
+
+void Checkpoint::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file) fclose(file);
+    file = nullptr;
+}
+
+void Checkpoint::remove() {
+    close();
+    if (!path.empty()) std::remove(path.c_str());
+}
@@ -0,0 +1,73 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include "renderer.h"
+
+// Finished tiles of a long render kept on disk, so a killed job can resume.
+// The file is a header followed by one record per finished tile: the tile index, its
+// sample count and the color of each pixel, either as the 8-bit RGB the image stores or,
+// for float outputs, as the accumulated (unclamped) color in floats. Records are only
+// appended, so a crash mid-write leaves at most a truncated last record, which is dropped
+// on load.
+class Checkpoint {
+public:
+    ~Checkpoint() { close(); }
+
+    // Start a checkpoint for a render into image. 'jobKey' identifies the scene and options.
+    // Float colors are kept when hdr is given, 8-bit ones otherwise. With resume, tiles from an
+    // existing file with the same key are written back into the image (and into hdr) and
+    // marked done; without it the file is started over. Returns false if it can't be written.
+    bool open(const std::string& path, uint64_t jobKey, bitmap_image& image, int tileSize, bool resume,
+              std::vector<Vector3D>* hdr = nullptr);
+
+    // True if path holds a checkpoint that open would resume for this render
+    static bool holdsJob(const std::string& path, uint64_t jobKey, const bitmap_image& image, int tileSize,
+                         bool hdr);
+
+    bool isDone(int tile) const { return tile < (int)done.size() && done[tile]; }
+    int doneCount() const;
+
+    // Record a finished tile; colors holds the accumulated color of the tile's pixels in
+    // row-major order. Safe to call from concurrent tile workers.
+    void tileFinished(int tile, const std::vector<Vector3D>& colors, int samples);
+
+    // Flush pending records to disk
+    void flush();
+    void close();
+    // Close and delete the file once the image has been saved
+    void remove();
+
+    double flushInterval = 2.0;     // seconds between flushes while rendering
+
+private:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t jobKey;
+        int32_t width, height, tileSize;
+        int32_t floatColor;         // 1 for float records, 0 for 8-bit; also keeps the header free of padding
+    };
+
+    // Pixel bounds [x0, x1) x [y0, y1) of a tile
+    void tileRect(int tile, int& x0, int& y0, int& x1, int& y1) const;
+    Header makeHeader() const;
+    bool loadInto(const std::string& from, FILE* to, bitmap_image& image, std::vector<Vector3D>* hdr);
+
+    std::string path;
+    FILE* file = nullptr;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point lastFlush;
+
+    uint64_t jobKey = 0;
+    bool floatColor = false;
+    int width = 0, height = 0, tileSize = 0, tilesX = 0, tilesY = 0;
+    std::vector<char> done;         // tiles restored from a previous run
+};
+
+#endif // CHECKPOINT_H
@@ -12,7 +12,7 @@ try {
 }
 
 Write-Host "`nCompiling main raytracer (with OpenGL)..."
-$compileMain = "g++ -o raytracer.exe 2005062_main.cpp intersection_implementations.cpp stb_image_impl.cpp -lfreeglut -lopengl32 -lglu32"
+$compileMain = "g++ -o raytracer.exe 2005062_main.cpp intersection_implementations.cpp light_table.cpp light_tree.cpp renderer.cpp tile_cache.cpp reprojection.cpp hybrid.cpp checkpoint.cpp budget.cpp tiled_output.cpp image_io.cpp traversal.cpp render_stats.cpp perf_counters.cpp heatmap.cpp trace.cpp tile_frustum.cpp scene.cpp bvh.cpp stb_image_impl.cpp -lfreeglut -lopengl32 -lglu32"
 Write-Host $compileMain
 try {
     Invoke-Expression $compileMain
@@ -27,7 +27,7 @@ try {
 }
 
 Write-Host "`nCompiling headless raytracer (for testing)..."
-$compileHeadless = "g++ -o raytracer_headless.exe raytracer_headless.cpp intersection_implementations.cpp stb_image_impl.cpp -lfreeglut -lopengl32 -lglu32"
+$compileHeadless = "g++ -o raytracer_headless.exe raytracer_headless.cpp intersection_implementations.cpp light_table.cpp light_tree.cpp renderer.cpp tile_cache.cpp reprojection.cpp hybrid.cpp checkpoint.cpp budget.cpp tiled_output.cpp image_io.cpp traversal.cpp render_stats.cpp perf_counters.cpp heatmap.cpp trace.cpp tile_frustum.cpp scene.cpp bvh.cpp stb_image_impl.cpp -lfreeglut -lopengl32 -lglu32"
 Write-Host $compileHeadless
 try {
     Invoke-Expression $compileHeadless
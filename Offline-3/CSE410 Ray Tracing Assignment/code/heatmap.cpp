@@ -0,0 +1,78 @@
+#include "heatmap.h"
+#include "image_io.h"
+#include <algorithm>
+#include <iostream>
+
+const char* costChannelName(int channel) {
+    switch (channel) {
+        case COST_NODE_VISITS: return "nodes";
+        case COST_PRIMITIVE_TESTS: return "tests";
+        case COST_SHADOW_RAYS: return "shadow";
+        default: return "depth";
+    }
+}
+
+void CostMaps::resize(int newWidth, int newHeight) {
+    width = newWidth;
+    height = newHeight;
+    for (std::vector<uint32_t>& channel : values) channel.assign(width * height, 0);
+}
+
+void CostMaps::record(int i, int j, const RayCounters& start) {
+    int index = j * width + i;
+    values[COST_NODE_VISITS][index] = rayCounters.nodeVisits - start.nodeVisits;
+    values[COST_PRIMITIVE_TESTS][index] = rayCounters.primitiveTests - start.primitiveTests;
+    values[COST_SHADOW_RAYS][index] = rayCounters.shadow - start.shadow;
+    values[COST_RAY_DEPTH][index] = rayCounters.nearest - start.nearest;
+}
+
+// Black, purple, red, orange, yellow, white for t from 0 to 1
+static void heatColor(double t, unsigned char& r, unsigned char& g, unsigned char& b) {
+    static const double stops[6][3] = {{0, 0, 0}, {0.35, 0.05, 0.55}, {0.85, 0.1, 0.2},
+                                       {1, 0.5, 0}, {1, 0.9, 0.1}, {1, 1, 1}};
+    t = std::max(0.0, std::min(1.0, t)) * 5;
+    int k = std::min(4, (int)t);
+    double f = t - k;
+    r = (unsigned char)(255 * (stops[k][0] + (stops[k + 1][0] - stops[k][0]) * f));
+    g = (unsigned char)(255 * (stops[k][1] + (stops[k + 1][1] - stops[k][1]) * f));
+    b = (unsigned char)(255 * (stops[k][2] + (stops[k + 1][2] - stops[k][2]) * f));
+}
+
+bool saveHeatmaps(const CostMaps& maps, const std::string& outputFile) {
+    if (maps.width <= 0 || maps.height <= 0) return false;
+    size_t dot = outputFile.find_last_of('.'), slash = outputFile.find_last_of("/\\");
+    std::string stem = (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+                           ? outputFile.substr(0, dot) : outputFile;
+
+    bool saved = true;
+    for (int channel = 0; channel < COST_CHANNEL_COUNT; channel++) {
+        const std::vector<uint32_t>& values = maps.values[channel];
+
+        // Scale to the 99th percentile so a few extreme pixels don't wash out the rest
+        std::vector<uint32_t> sorted(values);
+        size_t rank = std::min(sorted.size() - 1, sorted.size() * 99 / 100);
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        uint32_t top = std::max<uint32_t>(1, sorted[rank]);
+        uint32_t peak = *std::max_element(values.begin(), values.end());
+        double sum = 0;
+        for (uint32_t value : values) sum += value;
+
+        bitmap_image image(maps.width, maps.height);
+        for (int j = 0; j < maps.height; j++) {
+            for (int i = 0; i < maps.width; i++) {
+                unsigned char r, g, b;
+                heatColor((double)values[j * maps.width + i] / top, r, g, b);
+                image.set_pixel(i, j, r, g, b);
+            }
+        }
+        std::string path = stem + "." + costChannelName(channel) + ".bmp";
+        if (!saveImage(image, path)) {
+            std::cout << "Cannot write " << path << std::endl;
+            saved = false;
+            continue;
+        }
+        std::cout << "Heatmap saved as " << path << " (" << costChannelName(channel) << " per pixel: mean "
+                  << sum / values.size() << ", white at " << top << ", max " << peak << ")" << std::endl;
+    }
+    return saved;
+}
@@ -0,0 +1,35 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "2005062_classes.h"
+#include "render_stats.h"
+
+// What a pixel cost, one value per pixel and kind
+enum CostChannel {
+    COST_NODE_VISITS,       // acceleration structure nodes visited by all of the pixel's rays
+    COST_PRIMITIVE_TESTS,   // object intersection tests
+    COST_SHADOW_RAYS,
+    COST_RAY_DEPTH,         // closest-hit rays: the primary ray plus one per reflection bounce
+    COST_CHANNEL_COUNT
+};
+
+const char* costChannelName(int channel);
+
+// Per-pixel costs of a render, filled by renderImage when RenderOptions::costMaps is set
+struct CostMaps {
+    int width = 0, height = 0;
+    std::vector<uint32_t> values[COST_CHANNEL_COUNT];   // row-major, top row first
+
+    void resize(int width, int height);
+    // Store what this thread's rayCounters gained since 'start' as pixel (i, j)'s cost
+    void record(int i, int j, const RayCounters& start);
+};
+
+// Write each channel as <output stem>.<channel>.bmp, colored black (cheapest) through red to
+// white (the 99th percentile and above). Prints the file names and their scales.
+bool saveHeatmaps(const CostMaps& maps, const std::string& outputFile);
+
+#endif // HEATMAP_H
@@ -0,0 +1,172 @@
+#include "hybrid.h"
+#include "tile_cache.h"
+#include "render_stats.h"
+#include "bvh.h"
+#include <cmath>
+#include <algorithm>
+
+// Store a candidate in the visibility buffer if it is nearer than what is there
+static void depthTest(VisibilityBuffer& visibility, int index, int id, double t) {
+    if (t > 0 && (visibility.objectId[index] < 0 || t < visibility.depth[index])) {
+        visibility.objectId[index] = id;
+        visibility.depth[index] = t;
+    }
+}
+
+// Pixel range [x0, x1] x [y0, y1] covering the given continuous bounds, clipped to the image
+static bool pixelRange(const ImagePlane& plane, double minX, double maxX, double minY, double maxY,
+                       int& x0, int& x1, int& y0, int& y1) {
+    x0 = std::max(0, (int)ceil(minX));
+    x1 = std::min(plane.width - 1, (int)floor(maxX));
+    y0 = std::max(0, (int)ceil(minY));
+    y1 = std::min(plane.height - 1, (int)floor(maxY));
+    return x0 <= x1 && y0 <= y1;
+}
+
+// Edge-function rasterization with pixel centers at integer coordinates.
+// Depth is interpolated as 1/z (perspective correct), then turned into the ray distance.
+static bool rasterizeTriangle(const ImagePlane& plane, const Vector3D& look, Triangle* triangle, int id,
+                              VisibilityBuffer& visibility) {
+    double x[3], y[3], z[3];
+    Vector3D vertices[3] = {triangle->a, triangle->b, triangle->c};
+    for (int v = 0; v < 3; v++) {
+        if (!plane.project(vertices[v], x[v], y[v], z[v])) return false; // crosses the eye plane
+    }
+
+    double area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (fabs(area) < 1e-12) return true; // edge-on, covers no pixel centers
+
+    int x0, x1, y0, y1;
+    if (!pixelRange(plane, std::min(x[0], std::min(x[1], x[2])), std::max(x[0], std::max(x[1], x[2])),
+                    std::min(y[0], std::min(y[1], y[2])), std::max(y[0], std::max(y[1], y[2])),
+                    x0, x1, y0, y1)) {
+        return true;
+    }
+
+    double invArea = 1.0 / area;
+    for (int j = y0; j <= y1; j++) {
+        for (int i = x0; i <= x1; i++) {
+            // Barycentric weights from the three edge functions
+            double w0 = ((x[2] - x[1]) * (j - y[1]) - (y[2] - y[1]) * (i - x[1])) * invArea;
+            double w1 = ((x[0] - x[2]) * (j - y[2]) - (y[0] - y[2]) * (i - x[2])) * invArea;
+            double w2 = 1.0 - w0 - w1;
+            if (w0 < 0 || w1 < 0 || w2 < 0) continue;
+
+            double depth = 1.0 / (w0 / z[0] + w1 / z[1] + w2 / z[2]);
+            double cosView = plane.primaryRay(i, j).dir.dot(look);
+            depthTest(visibility, j * plane.width + i, id, depth / cosView);
+        }
+    }
+    return true;
+}
+
+// Pixel rows of the screen bounds of the sphere's box, each solved for the span of pixel
+// centers inside the sphere's outline. With d(x, y) the direction through pixel position
+// (x, y) and oc the vector from the eye to the center, the outline is where
+// (oc.d)^2 - (oc.oc - r^2)(d.d) = 0, quadratic in x along a row, and the depth of the front
+// surface inside it is (oc.d - sqrt of that) / |d|.
+static bool rasterizeSphere(const ImagePlane& plane, Sphere* sphere, int id, VisibilityBuffer& visibility) {
+    Bounds bounds = sphere->getBounds();
+    double minY = INFINITY, maxY = -INFINITY;
+    for (int corner = 0; corner < 8; corner++) {
+        Vector3D p((corner & 1) ? bounds.max.x : bounds.min.x,
+                   (corner & 2) ? bounds.max.y : bounds.min.y,
+                   (corner & 4) ? bounds.max.z : bounds.min.z);
+        double x, y, z;
+        if (!plane.project(p, x, y, z)) return false; // camera inside or next to the sphere
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+    }
+    int y0 = std::max(0, (int)ceil(minY)), y1 = std::min(plane.height - 1, (int)floor(maxY));
+
+    Vector3D oc = sphere->reference_point - plane.eye;
+    double radius = sphere->length;
+    double c0 = oc.dot(oc) - radius * radius;
+    Vector3D stepX = plane.right * plane.du;
+    double ba = oc.dot(stepX), aa = stepX.dot(stepX);
+    double qa = ba * ba - c0 * aa;
+    if (c0 <= 0 || qa >= 0) return false;  // outline is not a closed curve
+
+    for (int j = y0; j <= y1; j++) {
+        // Row j: d = rowStart + x * stepX
+        Vector3D rowStart = plane.topleft - plane.up * (j * plane.dv) - plane.eye;
+        double be = oc.dot(rowStart), ea = rowStart.dot(stepX), ee = rowStart.dot(rowStart);
+        double qb = 2 * (be * ba - c0 * ea), qc = be * be - c0 * ee;
+        double discriminant = qb * qb - 4 * qa * qc;
+        if (discriminant < 0) continue;     // row misses the outline
+
+        // qa < 0, so the larger root comes from subtracting
+        double root = sqrt(discriminant);
+        int x0 = std::max(0, (int)ceil((-qb + root) / (2 * qa)));
+        int x1 = std::min(plane.width - 1, (int)floor((-qb - root) / (2 * qa)));
+        for (int i = x0; i <= x1; i++) {
+            double inside = (qa * i + qb) * i + qc;
+            double along = be + ba * i;
+            double length = sqrt((aa * i + 2 * ea) * i + ee);
+            depthTest(visibility, j * plane.width + i, id, (along - sqrt(std::max(0.0, inside))) / length);
+        }
+    }
+    return true;
+}
+
+void rasterizeVisibility(const ImagePlane& plane, VisibilityBuffer& visibility) {
+    visibility.width = plane.width;
+    visibility.height = plane.height;
+    visibility.objectId.assign(plane.width * plane.height, -1);
+    visibility.depth.assign(plane.width * plane.height, 0);
+    visibility.rayTested.clear();
+    visibility.isRayTested.assign(objects.size(), 0);
+
+    Vector3D look = plane.up.cross(plane.right);
+    for (int k = 0; k < (int)objects.size(); k++) {
+        bool rasterized = false;
+        if (Triangle* triangle = dynamic_cast<Triangle*>(objects[k])) {
+            rasterized = rasterizeTriangle(plane, look, triangle, k, visibility);
+        } else if (Sphere* sphere = dynamic_cast<Sphere*>(objects[k])) {
+            rasterized = rasterizeSphere(plane, sphere, k, visibility);
+        }
+        if (!rasterized) {
+            visibility.rayTested.push_back(k);
+            visibility.isRayTested[k] = 1;
+        }
+    }
+}
+
+int resolveVisibility(const VisibilityBuffer& visibility, Ray* ray, int i, int j, double& tMin,
+                      const TileObjects* tileObjects) {
+    rayCounters.nearest++;
+    int index = j * visibility.width + i;
+    int nearest = visibility.objectId[index];
+    tMin = nearest >= 0 ? visibility.depth[index] : -1;
+
+    // The ray-tested objects, searched the way the ray tracer would but restricted to them
+    double t = -1;
+    int tested = -1;
+    if (tileObjects) {
+        rayCounters.primitiveTests += tileObjects->indices.size();
+        for (int k : tileObjects->indices) {
+            double tk = objects[k]->intersect(ray, nullptr, 0);
+            if (tk > 0 && (t < 0 || tk < t)) {
+                t = tk;
+                tested = k;
+            }
+        }
+    } else if (sceneBVH.usable()) {
+        tested = sceneBVH.nearest(ray, t, &visibility.isRayTested);
+    } else {
+        rayCounters.primitiveTests += visibility.rayTested.size();
+        for (int k : visibility.rayTested) {
+            double tk = objects[k]->intersect(ray, nullptr, 0);
+            if (tk > 0 && (t < 0 || tk < t)) {
+                t = tk;
+                tested = k;
+            }
+        }
+    }
+    if (tested != -1 && (nearest < 0 || t < tMin || (t == tMin && tested < nearest))) {
+        tMin = t;
+        nearest = tested;
+    }
+    if (activeTileRecord && nearest != -1) activeTileRecord->addObject(nearest);
+    return nearest;
+}
@@ -0,0 +1,30 @@
+#ifndef HYBRID_H
+#define HYBRID_H
+
+#include <vector>
+#include "renderer.h"
+#include "tile_frustum.h"
+
+// Primary visibility found by rasterization instead of primary rays
+struct VisibilityBuffer {
+    int width = 0, height = 0;
+    std::vector<int> objectId;      // nearest rasterized object per pixel, -1 if none
+    std::vector<double> depth;      // its distance along the pixel's primary ray
+    std::vector<int> rayTested;     // objects that can't be rasterized (floor, quadrics, triangles
+                                    // crossing the eye plane); tested with the primary ray per pixel
+    std::vector<char> isRayTested;  // per object, 1 for those in rayTested
+};
+
+// Rasterize the scene into a visibility buffer: triangles with edge functions and
+// perspective-correct depth, spheres by solving each pixel row against their projected
+// outline with the depth of the silhouette's front surface
+void rasterizeVisibility(const ImagePlane& plane, VisibilityBuffer& visibility);
+
+// Nearest object for the primary ray of pixel (i, j) from the visibility buffer and the
+// ray-tested objects; same contract and ray counting as findNearestObject. The ray-tested
+// objects come from tileObjects when given (gathered with visibility.isRayTested), from
+// sceneBVH otherwise.
+int resolveVisibility(const VisibilityBuffer& visibility, Ray* ray, int i, int j, double& tMin,
+                      const TileObjects* tileObjects = nullptr);
+
+#endif // HYBRID_H
@@ -0,0 +1,493 @@
+#include "image_io.h"
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <algorithm>
+
+bool hasExtension(const std::string& path, const std::string& extension) {
+    if (path.size() < extension.size()) return false;
+    std::string tail = path.substr(path.size() - extension.size());
+    std::transform(tail.begin(), tail.end(), tail.begin(), ::tolower);
+    return tail == extension;
+}
+
+ImageFormat imageFormatFor(const std::string& path) {
+    if (hasExtension(path, ".png")) return FORMAT_PNG;
+    if (hasExtension(path, ".qoi")) return FORMAT_QOI;
+    if (hasExtension(path, ".pfm")) return FORMAT_PFM;
+    if (hasExtension(path, ".exr")) return FORMAT_EXR;
+    return FORMAT_BMP;
+}
+
+const char* imageFormatName(ImageFormat format) {
+    switch (format) {
+        case FORMAT_PNG: return "PNG";
+        case FORMAT_QOI: return "QOI";
+        case FORMAT_PFM: return "PFM";
+        case FORMAT_EXR: return "EXR";
+        default: return "BMP";
+    }
+}
+
+bool isHdrFormat(ImageFormat format) {
+    return format == FORMAT_PFM || format == FORMAT_EXR;
+}
+
+static void putBE32(std::vector<unsigned char>& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back((value >> shift) & 0xFF);
+}
+
+static void putLE32(std::vector<unsigned char>& out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) out.push_back((value >> shift) & 0xFF);
+}
+
+static void putFloat(std::vector<unsigned char>& out, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    putLE32(out, bits);
+}
+
+// ---------------------------------------------------------------------------
+// Deflate: LZ77 over a 32K window with a one-probe hash table, coded with the fixed Huffman tables.
+// Filtered image rows are mostly small values and long repeats, which fixed codes handle well.
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<unsigned char>& out) : out(out) {}
+
+    // Write the low n bits of value, least significant first
+    void bits(uint32_t value, int n) {
+        buffer |= (uint64_t)value << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back(buffer & 0xFF);
+            buffer >>= 8;
+            count -= 8;
+        }
+    }
+
+    // Huffman codes are defined most significant bit first
+    void code(uint32_t value, int n) {
+        uint32_t reversed = 0;
+        for (int b = 0; b < n; b++) reversed |= ((value >> b) & 1) << (n - 1 - b);
+        bits(reversed, n);
+    }
+
+    void flush() {
+        if (count > 0) out.push_back(buffer & 0xFF);
+        buffer = 0;
+        count = 0;
+    }
+
+private:
+    std::vector<unsigned char>& out;
+    uint64_t buffer = 0;
+    int count = 0;
+};
+
+static const int LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const int LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                     3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const int DISTANCE_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                      513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const int DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+                                       8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Fixed Huffman code of every literal/length symbol, bit-reversed once so writing one is a
+// single bits() call
+struct FixedCode {
+    uint16_t bits;
+    uint8_t length;
+};
+
+static const FixedCode* fixedCodes() {
+    static FixedCode table[288];
+    static bool ready = [] {
+        for (int symbol = 0; symbol < 288; symbol++) {
+            uint32_t value;
+            int n;
+            if (symbol < 144) value = 0x30 + symbol, n = 8;
+            else if (symbol < 256) value = 0x190 + symbol - 144, n = 9;
+            else if (symbol < 280) value = symbol - 256, n = 7;
+            else value = 0xC0 + symbol - 280, n = 8;
+            uint32_t reversed = 0;
+            for (int b = 0; b < n; b++) reversed |= ((value >> b) & 1) << (n - 1 - b);
+            table[symbol] = FixedCode{(uint16_t)reversed, (uint8_t)n};
+        }
+        return true;
+    }();
+    (void)ready;
+    return table;
+}
+
+static void writeSymbol(BitWriter& writer, int symbol) {
+    static const FixedCode* codes = fixedCodes();
+    writer.bits(codes[symbol].bits, codes[symbol].length);
+}
+
+static void writeMatch(BitWriter& writer, int length, int distance) {
+    int l = std::upper_bound(LENGTH_BASE, LENGTH_BASE + 29, length) - LENGTH_BASE - 1;
+    writeSymbol(writer, 257 + l);
+    writer.bits(length - LENGTH_BASE[l], LENGTH_EXTRA[l]);
+
+    int d = std::upper_bound(DISTANCE_BASE, DISTANCE_BASE + 30, distance) - DISTANCE_BASE - 1;
+    writer.code(d, 5);
+    writer.bits(distance - DISTANCE_BASE[d], DISTANCE_EXTRA[d]);
+}
+
+static uint32_t adler32(const std::vector<unsigned char>& data) {
+    uint32_t a = 1, b = 0;
+    size_t i = 0;
+    while (i < data.size()) {
+        // 5552 bytes is the most that can be summed before the modulo is needed
+        size_t end = std::min(data.size(), i + 5552);
+        for (; i < end; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// zlib stream (header, one fixed-Huffman deflate block, Adler-32)
+static std::vector<unsigned char> zlibCompress(const std::vector<unsigned char>& data) {
+    const int WINDOW = 32768, HASH_BITS = 15, MIN_MATCH = 3, MAX_MATCH = 258;
+
+    std::vector<unsigned char> out;
+    out.push_back(0x78);
+    out.push_back(0x01);
+
+    BitWriter writer(out);
+    writer.bits(1, 1);  // final block
+    writer.bits(1, 2);  // fixed Huffman codes
+
+    // Latest position of every 3-byte hash
+    std::vector<int> head(1 << HASH_BITS, -1);
+    auto hashAt = [&data](size_t p) {
+        return ((data[p] << 10) ^ (data[p + 1] << 5) ^ data[p + 2]) & ((1 << HASH_BITS) - 1);
+    };
+    auto insert = [&](size_t p) { head[hashAt(p)] = (int)p; };
+
+    size_t n = data.size(), p = 0;
+    while (p < n) {
+        int bestLength = 0, bestDistance = 0;
+        if (p + MIN_MATCH <= n) {
+            int limit = (int)std::min<size_t>(MAX_MATCH, n - p);
+            // Only the most recent position with the same hash is tried; following a chain of
+            // 8 older ones made renders about 12% smaller but deflate about 1.5x slower
+            int candidate = head[hashAt(p)];
+            if (candidate >= 0 && p - candidate <= (size_t)WINDOW) {
+                int length = 0;
+                while (length < limit && data[candidate + length] == data[p + length]) length++;
+                bestLength = length;
+                bestDistance = (int)(p - candidate);
+            }
+        }
+
+        if (bestLength >= MIN_MATCH) {
+            writeMatch(writer, bestLength, bestDistance);
+            for (int k = 0; k < bestLength; k++, p++) {
+                if (p + MIN_MATCH <= n) insert(p);
+            }
+        } else {
+            writeSymbol(writer, data[p]);
+            if (p + MIN_MATCH <= n) insert(p);
+            p++;
+        }
+    }
+    writeSymbol(writer, 256);   // end of block
+    writer.flush();
+
+    putBE32(out, adler32(data));
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// PNG
+
+static uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0) {
+    static uint32_t table[256];
+    static bool tableReady = [] {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        return true;
+    }();
+    (void)tableReady;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void writeChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data) {
+    putBE32(out, data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    putBE32(out, crc32(&out[start], out.size() - start));
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+std::vector<unsigned char> encodePng(const bitmap_image& image) {
+    int width = image.width(), height = image.height();
+    int stride = width * 3;
+
+    // Each row gets the filter with the smallest sum of absolute (signed) residuals
+    std::vector<unsigned char> filtered;
+    filtered.reserve((size_t)(stride + 1) * height);
+    std::vector<unsigned char> previous(stride, 0), current(stride), candidate(stride), best(stride);
+    for (int j = 0; j < height; j++) {
+        const unsigned char* row = image.row(j);
+        for (int i = 0; i < width; i++) {
+            // bitmap_image rows are BGR
+            current[i * 3] = row[i * 3 + 2];
+            current[i * 3 + 1] = row[i * 3 + 1];
+            current[i * 3 + 2] = row[i * 3];
+        }
+
+        long bestCost = -1;
+        int bestFilter = 0;
+        for (int filter = 0; filter < 5; filter++) {
+            // One loop per filter, so the predictor isn't picked again for every byte; the
+            // first pixel has no left neighbours
+            auto apply = [&](auto predict) {
+                long cost = 0;
+                for (int x = 0; x < std::min(3, stride); x++) {
+                    candidate[x] = (unsigned char)(current[x] - predict(0, previous[x], 0));
+                    cost += abs((signed char)candidate[x]);
+                }
+                for (int x = 3; x < stride; x++) {
+                    candidate[x] = (unsigned char)(current[x] - predict(current[x - 3], previous[x], previous[x - 3]));
+                    cost += abs((signed char)candidate[x]);
+                }
+                return cost;
+            };
+            long cost = 0;
+            switch (filter) {
+                case 0: cost = apply([](int, int, int) { return 0; }); break;
+                case 1: cost = apply([](int a, int, int) { return a; }); break;
+                case 2: cost = apply([](int, int b, int) { return b; }); break;
+                case 3: cost = apply([](int a, int b, int) { return (a + b) / 2; }); break;
+                case 4: cost = apply(paeth); break;
+            }
+            if (bestCost < 0 || cost < bestCost) {
+                bestCost = cost;
+                bestFilter = filter;
+                best.swap(candidate);
+            }
+        }
+        filtered.push_back(bestFilter);
+        filtered.insert(filtered.end(), best.begin(), best.end());
+        previous.swap(current);
+    }
+
+    std::vector<unsigned char> out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    std::vector<unsigned char> header;
+    putBE32(header, width);
+    putBE32(header, height);
+    header.push_back(8);    // bits per channel
+    header.push_back(2);    // truecolor RGB
+    header.push_back(0);    // deflate
+    header.push_back(0);    // adaptive filtering
+    header.push_back(0);    // no interlace
+    writeChunk(out, "IHDR", header);
+    writeChunk(out, "IDAT", zlibCompress(filtered));
+    writeChunk(out, "IEND", std::vector<unsigned char>());
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// QOI, following the specification at qoiformat.org
+
+std::vector<unsigned char> encodeQoi(const bitmap_image& image) {
+    int width = image.width(), height = image.height();
+    std::vector<unsigned char> out = {'q', 'o', 'i', 'f'};
+    out.reserve(14 + (size_t)width * height * 4 + 8);
+    putBE32(out, width);
+    putBE32(out, height);
+    out.push_back(3);   // RGB
+    out.push_back(0);   // sRGB with linear alpha
+
+    struct Pixel { unsigned char r, g, b; };
+    Pixel index[64] = {};
+    Pixel last = {0, 0, 0};
+    int run = 0;
+    size_t remaining = (size_t)width * height;
+
+    for (int j = 0; j < height; j++) {
+        const unsigned char* row = image.row(j);
+        for (int i = 0; i < width; i++) {
+            Pixel px = {row[i * 3 + 2], row[i * 3 + 1], row[i * 3]};
+            remaining--;
+
+            if (px.r == last.r && px.g == last.g && px.b == last.b) {
+                if (++run == 62 || remaining == 0) {
+                    out.push_back(0xC0 | (run - 1));    // QOI_OP_RUN
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                out.push_back(0xC0 | (run - 1));
+                run = 0;
+            }
+
+            // Alpha is always 255
+            int slot = (px.r * 3 + px.g * 5 + px.b * 7 + 255 * 11) % 64;
+            if (index[slot].r == px.r && index[slot].g == px.g && index[slot].b == px.b) {
+                out.push_back(slot);                    // QOI_OP_INDEX
+            } else {
+                index[slot] = px;
+                int dr = (signed char)(px.r - last.r), dg = (signed char)(px.g - last.g);
+                int db = (signed char)(px.b - last.b);
+                int drg = dr - dg, dbg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));    // QOI_OP_DIFF
+                } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                    out.push_back(0x80 | (dg + 32));                                // QOI_OP_LUMA
+                    out.push_back((drg + 8) << 4 | (dbg + 8));
+                } else {
+                    out.push_back(0xFE);                                            // QOI_OP_RGB
+                    out.push_back(px.r);
+                    out.push_back(px.g);
+                    out.push_back(px.b);
+                }
+            }
+            last = px;
+        }
+    }
+
+    const unsigned char padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    out.insert(out.end(), padding, padding + 8);
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// Float formats
+
+std::vector<unsigned char> encodePfm(const std::vector<Vector3D>& pixels, int width, int height) {
+    // A negative scale marks little-endian data; rows are stored bottom to top
+    std::string header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+    std::vector<unsigned char> out(header.begin(), header.end());
+    out.reserve(out.size() + (size_t)width * height * 12);
+    for (int j = height - 1; j >= 0; j--) {
+        for (int i = 0; i < width; i++) {
+            const Vector3D& c = pixels[(size_t)j * width + i];
+            putFloat(out, c.x);
+            putFloat(out, c.y);
+            putFloat(out, c.z);
+        }
+    }
+    return out;
+}
+
+static void exrAttribute(std::vector<unsigned char>& out, const char* name, const char* type,
+                         const std::vector<unsigned char>& value) {
+    out.insert(out.end(), name, name + strlen(name) + 1);
+    out.insert(out.end(), type, type + strlen(type) + 1);
+    putLE32(out, value.size());
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+std::vector<unsigned char> encodeExr(const std::vector<Vector3D>& pixels, int width, int height) {
+    std::vector<unsigned char> out = {0x76, 0x2F, 0x31, 0x01};
+    putLE32(out, 2);    // version 2, single-part scanline file
+
+    // Channels must be listed in alphabetical order; all 32-bit float
+    std::vector<unsigned char> channels;
+    for (const char* name : {"B", "G", "R"}) {
+        channels.insert(channels.end(), name, name + 2);
+        putLE32(channels, 2);                           // FLOAT
+        channels.insert(channels.end(), {0, 0, 0, 0});  // pLinear and reserved
+        putLE32(channels, 1);                           // x sampling
+        putLE32(channels, 1);                           // y sampling
+    }
+    channels.push_back(0);
+
+    std::vector<unsigned char> window;
+    for (int v : {0, 0, width - 1, height - 1}) putLE32(window, v);
+    std::vector<unsigned char> one, center, zero = {0};
+    putFloat(one, 1.0f);
+    putFloat(center, 0.0f);
+    putFloat(center, 0.0f);
+
+    exrAttribute(out, "channels", "chlist", channels);
+    exrAttribute(out, "compression", "compression", zero);
+    exrAttribute(out, "dataWindow", "box2i", window);
+    exrAttribute(out, "displayWindow", "box2i", window);
+    exrAttribute(out, "lineOrder", "lineOrder", zero);
+    exrAttribute(out, "pixelAspectRatio", "float", one);
+    exrAttribute(out, "screenWindowCenter", "v2f", center);
+    exrAttribute(out, "screenWindowWidth", "float", one);
+    out.push_back(0);
+
+    // Offset table: one uncompressed scanline per block, each block the same size
+    uint32_t blockData = (uint32_t)width * 3 * 4;
+    uint64_t firstBlock = out.size() + (uint64_t)height * 8;
+    for (int j = 0; j < height; j++) {
+        uint64_t offset = firstBlock + (uint64_t)j * (8 + blockData);
+        putLE32(out, offset & 0xFFFFFFFF);
+        putLE32(out, offset >> 32);
+    }
+
+    out.reserve(firstBlock + (size_t)height * (8 + blockData));
+    for (int j = 0; j < height; j++) {
+        putLE32(out, j);
+        putLE32(out, blockData);
+        const Vector3D* row = &pixels[(size_t)j * width];
+        for (int i = 0; i < width; i++) putFloat(out, row[i].z);
+        for (int i = 0; i < width; i++) putFloat(out, row[i].y);
+        for (int i = 0; i < width; i++) putFloat(out, row[i].x);
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+
+static bool writeFile(const std::string& path, const std::vector<unsigned char>& data) {
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return (bool)file;
+}
+
+bool saveHdrImage(const std::vector<Vector3D>& pixels, int width, int height, const std::string& path) {
+    ImageFormat format = imageFormatFor(path);
+    if (format == FORMAT_EXR) return writeFile(path, encodeExr(pixels, width, height));
+    return writeFile(path, encodePfm(pixels, width, height));
+}
+
+bool saveImage(const bitmap_image& image, const std::string& path) {
+    ImageFormat format = imageFormatFor(path);
+    switch (format) {
+        case FORMAT_PNG: return writeFile(path, encodePng(image));
+        case FORMAT_QOI: return writeFile(path, encodeQoi(image));
+        case FORMAT_PFM:
+        case FORMAT_EXR: {
+            std::vector<Vector3D> pixels((size_t)image.width() * image.height());
+            for (unsigned int j = 0; j < image.height(); j++) {
+                for (unsigned int i = 0; i < image.width(); i++) {
+                    unsigned char r, g, b;
+                    image.get_pixel(i, j, r, g, b);
+                    pixels[(size_t)j * image.width() + i] = Vector3D(r, g, b) * (1.0 / 255);
+                }
+            }
+            return saveHdrImage(pixels, image.width(), image.height(), path);
+        }
+        default:
+            image.save_image(path);
+            return std::ifstream(path).good();
+    }
+}
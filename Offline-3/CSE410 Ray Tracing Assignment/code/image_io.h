@@ -0,0 +1,35 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <string>
+#include <vector>
+#include "2005062_classes.h"
+
+// Output formats, picked from the file extension
+enum ImageFormat {
+    FORMAT_BMP,     // uncompressed 24-bit, bitmap_image's own writer
+    FORMAT_PNG,     // lossless, per-row filters + deflate
+    FORMAT_QOI,     // lossless, "Quite OK Image" format; much faster than PNG
+    FORMAT_PFM,     // 32-bit float RGB
+    FORMAT_EXR      // OpenEXR, uncompressed 32-bit float scanlines
+};
+
+bool hasExtension(const std::string& path, const std::string& extension);
+// Format for a file name; BMP for unknown extensions
+ImageFormat imageFormatFor(const std::string& path);
+const char* imageFormatName(ImageFormat format);
+// True for the float formats, which can hold the unclamped colors
+bool isHdrFormat(ImageFormat format);
+
+// Encoders writing a whole file into memory
+std::vector<unsigned char> encodePng(const bitmap_image& image);
+std::vector<unsigned char> encodeQoi(const bitmap_image& image);
+std::vector<unsigned char> encodePfm(const std::vector<Vector3D>& pixels, int width, int height);
+std::vector<unsigned char> encodeExr(const std::vector<Vector3D>& pixels, int width, int height);
+
+// Save in the format given by the extension. Float formats get the 8-bit colors scaled to [0, 1].
+bool saveImage(const bitmap_image& image, const std::string& path);
+// Save unclamped colors (row-major, top row first) to a float format
+bool saveHdrImage(const std::vector<Vector3D>& pixels, int width, int height, const std::string& path);
+
+#endif // IMAGE_IO_H
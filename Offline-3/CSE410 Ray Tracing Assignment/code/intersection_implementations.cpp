@@ -1,131 +1,207 @@
 #include "2005062_classes.h"
+#include "light_table.h"
+#include "light_tree.h"
+#include "tile_cache.h"
+#include "render_stats.h"
+#include "bvh.h"
 #include <cmath>
 #include <algorithm>
 
-// Sphere intersection implementation
-double Sphere::intersect(Ray* r, double* color, int level) {
-    Vector3D oc = r->start - reference_point;
-    double a = r->dir.dot(r->dir);
-    double b = 2.0 * oc.dot(r->dir);
-    double c = oc.dot(oc) - length * length; // length stores radius
-    
-    double discriminant = b * b - 4 * a * c;
-    if (discriminant < 0) return -1; // no intersection
-    
-    double t1 = (-b - sqrt(discriminant)) / (2 * a);
-    double t2 = (-b + sqrt(discriminant)) / (2 * a);
-    
-    double t = -1;
-    if (t1 > 0) t = t1;
-    else if (t2 > 0) t = t2;
-    
-    if (t < 0 || level == 0) return t;
-    
-    // Calculate color using Phong lighting
-    Vector3D intersectionPoint = r->start + r->dir * t;
-    Vector3D normal = getNormal(intersectionPoint);
-    Vector3D intersectionColor = getColorAt(intersectionPoint);
+// Check whether any object other than 'self' blocks the shadow ray
+static bool isInShadow(Ray* shadowRay, Object* self) {
+    rayCounters.shadow++;
+    if (sceneBVH.usable()) {
+        int blocker = sceneBVH.anyHit(shadowRay, self);
+        if (activeTileRecord && blocker != -1) activeTileRecord->addObject(blocker);
+        return blocker != -1;
+    }
+    for (int k = 0; k < objects.size(); k++) {
+        if (objects[k] != self) { // don't check intersection with self
+            rayCounters.primitiveTests++;
+            double shadowT = objects[k]->intersect(shadowRay, nullptr, 0);
+            if (shadowT > 0) {
+                if (activeTileRecord) activeTileRecord->addObject(k);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int findNearestObject(Ray* ray, double& tMin) {
+    rayCounters.nearest++;
+    tMin = -1;
+    int nearest = -1;
+    if (sceneBVH.usable()) {
+        nearest = sceneBVH.nearest(ray, tMin);
+    } else {
+        rayCounters.primitiveTests += objects.size();
+        for (int k = 0; k < objects.size(); k++) {
+            double t = objects[k]->intersect(ray, nullptr, 0);
+            if (t > 0 && (tMin < 0 || t < tMin)) {
+                tMin = t;
+                nearest = k;
+            }
+        }
+    }
+    if (activeTileRecord && nearest != -1) activeTileRecord->addObject(nearest);
+    return nearest;
+}
+
+// Per-thread scratch space for the light loop in Object::shade
+struct LightScratch {
+    LightTable selected;                // lights picked by the light tree when sampling or culling
+    std::vector<LightSample> samples;
+    std::vector<double> weight;
+    std::vector<double> dirX, dirY, dirZ, lambert;
+    std::vector<char> lit;
+};
+
+// Direction to each light, Lambert term and spotlight cone test for a packed light table.
+// Only arithmetic on flat arrays, so the compiler can vectorize the loop.
+static void evaluateLights(const LightTable& lights, const Vector3D& point, const Vector3D& normal,
+                           LightScratch& s) {
+    int count = lights.size();
+    s.dirX.resize(count); s.dirY.resize(count); s.dirZ.resize(count);
+    s.lambert.resize(count);
+    s.lit.resize(count);
+    
+    const double* px = lights.posX.data();
+    const double* py = lights.posY.data();
+    const double* pz = lights.posZ.data();
+    const double* ax = lights.dirX.data();
+    const double* ay = lights.dirY.data();
+    const double* az = lights.dirZ.data();
+    const double* cosCutoff = lights.cosCutoff.data();
+    double* lx = s.dirX.data();
+    double* ly = s.dirY.data();
+    double* lz = s.dirZ.data();
+    double* lambert = s.lambert.data();
+    char* lit = s.lit.data();
+    
+    for (int i = 0; i < count; i++) {
+        double dx = px[i] - point.x;
+        double dy = py[i] - point.y;
+        double dz = pz[i] - point.z;
+        double invLength = 1.0 / sqrt(dx * dx + dy * dy + dz * dz);
+        dx *= invLength; dy *= invLength; dz *= invLength;
+        
+        // Inside the cone when the light-to-point direction is within the cutoff of the axis
+        double cosToPoint = -(dx * ax[i] + dy * ay[i] + dz * az[i]);
+        lit[i] = cosToPoint >= cosCutoff[i];
+        
+        lx[i] = dx; ly[i] = dy; lz[i] = dz;
+        lambert[i] = std::max(0.0, normal.x * dx + normal.y * dy + normal.z * dz);
+    }
+}
+
+// Phong lighting and reflection shared by all object types.
+// Picks the kernel for the material class once per hit.
+void Object::shade(Ray* r, double t, double* color, int level) {
+    shadeHit(r, surfaceAt(r, t), color, level);
+}
+
+SurfaceHit Object::surfaceAt(Ray* r, double t) {
+    SurfaceHit hit;
+    hit.point = r->start + r->dir * t;
+    hit.normal = getNormal(hit.point);
+    hit.baseColor = isTextured() ? getColorAt(hit.point) : Vector3D(color[0], color[1], color[2]);
+    return hit;
+}
+
+void Object::shadeHit(Ray* r, const SurfaceHit& hit, double* color, int level) {
+    switch (materialClass) {
+        case MATERIAL_DIFFUSE: shadeKernel<false, false, false>(r, hit, color, level); break;
+        case MATERIAL_PHONG:   shadeKernel<true, false, false>(r, hit, color, level); break;
+        case MATERIAL_MIRROR:  shadeKernel<true, true, false>(r, hit, color, level); break;
+        default:               shadeKernel<true, true, true>(r, hit, color, level); break;
+    }
+}
+
+// Shading kernel; terms a material class does not have are compiled out.
+// Untextured objects read their color directly so edited colors apply to cached hits too.
+template <bool Specular, bool Reflective, bool Textured>
+void Object::shadeKernel(Ray* r, const SurfaceHit& hit, double* color, int level) {
+    const Vector3D& intersectionPoint = hit.point;
+    const Vector3D& normal = hit.normal;
+    Vector3D intersectionColor = Textured ? hit.baseColor
+                                          : Vector3D(this->color[0], this->color[1], this->color[2]);
     
     // Ambient component
     color[0] = intersectionColor.x * coEfficients[0];
     color[1] = intersectionColor.y * coEfficients[0];
     color[2] = intersectionColor.z * coEfficients[0];
     
-    // Process each point light
-    for (const auto& light : pointLights) {
-        Vector3D lightDir = (light.light_pos - intersectionPoint).normalize();
+    // Every light, or the subset (with weights) picked by the light tree
+    static thread_local LightScratch scratch;
+    const LightTable* lights = &lightTable;
+    const double* weights = nullptr;
+    if (!lightTree.usesAllLights()) {
+        lightTree.gatherLights(intersectionPoint, normal, coEfficients[1], coEfficients[2], scratch.samples);
+        scratch.selected.clear();
+        scratch.weight.clear();
+        for (const auto& sample : scratch.samples) {
+            scratch.selected.addFrom(lightTable, sample.index);
+            scratch.weight.push_back(sample.weight);
+        }
+        lights = &scratch.selected;
+        weights = scratch.weight.data();
+    }
+    
+    evaluateLights(*lights, intersectionPoint, normal, scratch);
+    
+    // Every shadow ray from this hit starts at the same offset point
+    Vector3D shadowOrigin = intersectionPoint + normal * 0.001; // slight offset
+    if (activeTileRecord) activeTileRecord->shadowOrigins.extend(shadowOrigin);
+    
+    Vector3D viewDir;
+    if (Specular) viewDir = (r->start - intersectionPoint).normalize();
+    
+    for (int i = 0; i < lights->size(); i++) {
+        if (!scratch.lit[i]) continue;
+        // Without a specular term, lights behind the surface add nothing
+        if (!Specular && scratch.lambert[i] <= 0) continue;
         
         // Check for shadows
-        Ray shadowRay(intersectionPoint + normal * 0.001, lightDir); // slight offset
-        bool inShadow = false;
+        Vector3D lightDir(scratch.dirX[i], scratch.dirY[i], scratch.dirZ[i]);
+        Ray shadowRay(shadowOrigin, lightDir);
+        if (isInShadow(&shadowRay, this)) continue;
         
-        for (auto obj : objects) {
-            if (obj != this) { // don't check intersection with self
-                double shadowT = obj->intersect(&shadowRay, nullptr, 0);
-                if (shadowT > 0) {
-                    inShadow = true;
-                    break;
-                }
-            }
-        }
+        double weight = weights ? weights[i] : 1.0;
+        double lightR = weight * lights->colorR[i];
+        double lightG = weight * lights->colorG[i];
+        double lightB = weight * lights->colorB[i];
         
-        if (!inShadow) {
-            // Diffuse component
-            double lambertValue = std::max(0.0, normal.dot(lightDir));
-            color[0] += light.color[0] * coEfficients[1] * lambertValue * intersectionColor.x;
-            color[1] += light.color[1] * coEfficients[1] * lambertValue * intersectionColor.y;
-            color[2] += light.color[2] * coEfficients[1] * lambertValue * intersectionColor.z;
-            
-            // Specular component
-            Vector3D viewDir = (r->start - intersectionPoint).normalize();
+        // Diffuse component
+        double lambertValue = scratch.lambert[i];
+        color[0] += lightR * coEfficients[1] * lambertValue * intersectionColor.x;
+        color[1] += lightG * coEfficients[1] * lambertValue * intersectionColor.y;
+        color[2] += lightB * coEfficients[1] * lambertValue * intersectionColor.z;
+        
+        // Specular component
+        if (Specular) {
             Vector3D reflectDir = (lightDir * -1 + normal * (2 * normal.dot(lightDir))).normalize();
             double phongValue = std::max(0.0, viewDir.dot(reflectDir));
-            phongValue = pow(phongValue, shine);
-            
-            color[0] += light.color[0] * coEfficients[2] * phongValue;
-            color[1] += light.color[1] * coEfficients[2] * phongValue;
-            color[2] += light.color[2] * coEfficients[2] * phongValue;
-        }
-    }
-    
-    // Process each spotlight
-    for (const auto& spotlight : spotLights) {
-        Vector3D lightDir = (spotlight.point_light.light_pos - intersectionPoint).normalize();
-        
-        // Check if within cutoff angle
-        Vector3D lightToPoint = (intersectionPoint - spotlight.point_light.light_pos).normalize();
-        double angle = acos(lightToPoint.dot(spotlight.light_direction.normalize())) * 180.0 / M_PI;
-        
-        if (angle <= spotlight.cutoff_angle) {
-            // Check for shadows
-            Ray shadowRay(intersectionPoint + normal * 0.001, lightDir);
-            bool inShadow = false;
-            
-            for (auto obj : objects) {
-                if (obj != this) {
-                    double shadowT = obj->intersect(&shadowRay, nullptr, 0);
-                    if (shadowT > 0) {
-                        inShadow = true;
-                        break;
-                    }
-                }
-            }
+            phongValue = powInt(phongValue, shine);
             
-            if (!inShadow) {
-                // Diffuse component
-                double lambertValue = std::max(0.0, normal.dot(lightDir));
-                color[0] += spotlight.point_light.color[0] * coEfficients[1] * lambertValue * intersectionColor.x;
-                color[1] += spotlight.point_light.color[1] * coEfficients[1] * lambertValue * intersectionColor.y;
-                color[2] += spotlight.point_light.color[2] * coEfficients[1] * lambertValue * intersectionColor.z;
-                
-                // Specular component
-                Vector3D viewDir = (r->start - intersectionPoint).normalize();
-                Vector3D reflectDir = (lightDir * -1 + normal * (2 * normal.dot(lightDir))).normalize();
-                double phongValue = std::max(0.0, viewDir.dot(reflectDir));
-                phongValue = pow(phongValue, shine);
-                
-                color[0] += spotlight.point_light.color[0] * coEfficients[2] * phongValue;
-                color[1] += spotlight.point_light.color[1] * coEfficients[2] * phongValue;
-                color[2] += spotlight.point_light.color[2] * phongValue;
-            }
+            color[0] += lightR * coEfficients[2] * phongValue;
+            color[1] += lightG * coEfficients[2] * phongValue;
+            color[2] += lightB * coEfficients[2] * phongValue;
         }
     }
     
     // Handle reflection if recursion level allows
-    if (level < recursionLevel && coEfficients[3] > 0) {
+    if (Reflective && level < recursionLevel && coEfficients[3] > 0) {
         Vector3D reflectDir = (r->dir - normal * (2 * r->dir.dot(normal))).normalize();
         Ray reflectedRay(intersectionPoint + reflectDir * 0.0001, reflectDir);
+        if (activeTileRecord) {
+            activeTileRecord->secondaryOrigins.extend(reflectedRay.start);
+            activeTileRecord->secondaryDirections.extend(reflectedRay.dir);
+        }
         
         // Find nearest intersection for reflected ray
-        double reflectT = -1;
-        int nearest = -1;
-        for (int i = 0; i < objects.size(); i++) {
-            double t = objects[i]->intersect(&reflectedRay, nullptr, 0);
-            if (t > 0 && (reflectT < 0 || t < reflectT)) {
-                reflectT = t;
-                nearest = i;
-            }
-        }
+        double reflectT;
+        int nearest = findNearestObject(&reflectedRay, reflectT);
         
         if (nearest != -1) {
             double reflectedColor[3] = {0, 0, 0};
@@ -136,6 +212,28 @@ double Sphere::intersect(Ray* r, double* color, int level) {
             color[2] += reflectedColor[2] * coEfficients[3];
         }
     }
+}
+
+// Sphere intersection implementation
+double Sphere::intersect(Ray* r, double* color, int level) {
+    Vector3D oc = r->start - reference_point;
+    double a = r->dir.dot(r->dir);
+    double b = 2.0 * oc.dot(r->dir);
+    double c = oc.dot(oc) - length * length; // length stores radius
+    
+    double discriminant = b * b - 4 * a * c;
+    if (discriminant < 0) return -1; // no intersection
+    
+    double t1 = (-b - sqrt(discriminant)) / (2 * a);
+    double t2 = (-b + sqrt(discriminant)) / (2 * a);
+    
+    double t = -1;
+    if (t1 > 0) t = t1;
+    else if (t2 > 0) t = t2;
+    
+    if (t < 0 || level == 0) return t;
+    
+    shade(r, t, color, level);
     
     return t;
 }
@@ -163,77 +261,7 @@ double Floor::intersect(Ray* r, double* color, int level) {
     
     if (level == 0) return t;
     
-    // Calculate checkerboard color
-    Vector3D intersectionColor = getColorAt(intersectionPoint);
-    Vector3D normal = getNormal(intersectionPoint); // (0, 0, 1) for floor
-    
-    // Ambient component
-    color[0] = intersectionColor.x * coEfficients[0];
-    color[1] = intersectionColor.y * coEfficients[0];
-    color[2] = intersectionColor.z * coEfficients[0];
-    
-    // Process each point light
-    for (const auto& light : pointLights) {
-        Vector3D lightDir = (light.light_pos - intersectionPoint).normalize();
-        
-        // Check for shadows
-        Ray shadowRay(intersectionPoint + normal * 0.001, lightDir);
-        bool inShadow = false;
-        
-        for (auto obj : objects) {
-            if (obj != this) {
-                double shadowT = obj->intersect(&shadowRay, nullptr, 0);
-                if (shadowT > 0) {
-                    inShadow = true;
-                    break;
-                }
-            }
-        }
-        
-        if (!inShadow) {
-            // Diffuse component
-            double lambertValue = std::max(0.0, normal.dot(lightDir));
-            color[0] += light.color[0] * coEfficients[1] * lambertValue * intersectionColor.x;
-            color[1] += light.color[1] * coEfficients[1] * lambertValue * intersectionColor.y;
-            color[2] += light.color[2] * coEfficients[1] * lambertValue * intersectionColor.z;
-            
-            // Specular component
-            Vector3D viewDir = (r->start - intersectionPoint).normalize();
-            Vector3D reflectDir = (lightDir * -1 + normal * (2 * normal.dot(lightDir))).normalize();
-            double phongValue = std::max(0.0, viewDir.dot(reflectDir));
-            phongValue = pow(phongValue, shine);
-            
-            color[0] += light.color[0] * coEfficients[2] * phongValue;
-            color[1] += light.color[1] * coEfficients[2] * phongValue;
-            color[2] += light.color[2] * coEfficients[2] * phongValue;
-        }
-    }
-    
-    // Handle reflection if recursion level allows
-    if (level < recursionLevel && coEfficients[3] > 0) {
-        Vector3D reflectDir = (r->dir - normal * (2 * r->dir.dot(normal))).normalize();
-        Ray reflectedRay(intersectionPoint + reflectDir * 0.0001, reflectDir);
-        
-        // Find nearest intersection for reflected ray
-        double reflectT = -1;
-        int nearest = -1;
-        for (int i = 0; i < objects.size(); i++) {
-            double t = objects[i]->intersect(&reflectedRay, nullptr, 0);
-            if (t > 0 && (reflectT < 0 || t < reflectT)) {
-                reflectT = t;
-                nearest = i;
-            }
-        }
-        
-        if (nearest != -1) {
-            double reflectedColor[3] = {0, 0, 0};
-            objects[nearest]->intersect(&reflectedRay, reflectedColor, level + 1);
-            
-            color[0] += reflectedColor[0] * coEfficients[3];
-            color[1] += reflectedColor[1] * coEfficients[3];
-            color[2] += reflectedColor[2] * coEfficients[3];
-        }
-    }
+    shade(r, t, color, level);
     
     return t;
 }
@@ -342,78 +370,7 @@ double Triangle::intersect(Ray* r, double* color, int level) {
     
     if (level == 0) return t;
     
-    // Calculate color using similar lighting as sphere
-    Vector3D intersectionPoint = r->start + r->dir * t;
-    Vector3D normal = getNormal(intersectionPoint);
-    Vector3D intersectionColor = getColorAt(intersectionPoint);
-    
-    // Ambient component
-    color[0] = intersectionColor.x * coEfficients[0];
-    color[1] = intersectionColor.y * coEfficients[0];
-    color[2] = intersectionColor.z * coEfficients[0];
-    
-    // Process each point light (similar to sphere implementation)
-    for (const auto& light : pointLights) {
-        Vector3D lightDir = (light.light_pos - intersectionPoint).normalize();
-        
-        // Check for shadows
-        Ray shadowRay(intersectionPoint + normal * 0.001, lightDir);
-        bool inShadow = false;
-        
-        for (auto obj : objects) {
-            if (obj != this) {
-                double shadowT = obj->intersect(&shadowRay, nullptr, 0);
-                if (shadowT > 0) {
-                    inShadow = true;
-                    break;
-                }
-            }
-        }
-        
-        if (!inShadow) {
-            // Diffuse component
-            double lambertValue = std::max(0.0, normal.dot(lightDir));
-            color[0] += light.color[0] * coEfficients[1] * lambertValue * intersectionColor.x;
-            color[1] += light.color[1] * coEfficients[1] * lambertValue * intersectionColor.y;
-            color[2] += light.color[2] * coEfficients[1] * lambertValue * intersectionColor.z;
-            
-            // Specular component
-            Vector3D viewDir = (r->start - intersectionPoint).normalize();
-            Vector3D reflectDir = (lightDir * -1 + normal * (2 * normal.dot(lightDir))).normalize();
-            double phongValue = std::max(0.0, viewDir.dot(reflectDir));
-            phongValue = pow(phongValue, shine);
-            
-            color[0] += light.color[0] * coEfficients[2] * phongValue;
-            color[1] += light.color[1] * coEfficients[2] * phongValue;
-            color[2] += light.color[2] * phongValue;
-        }
-    }
-    
-    // Handle reflection
-    if (level < recursionLevel && coEfficients[3] > 0) {
-        Vector3D reflectDir = (r->dir - normal * (2 * r->dir.dot(normal))).normalize();
-        Ray reflectedRay(intersectionPoint + reflectDir * 0.0001, reflectDir);
-        
-        // Find nearest intersection for reflected ray
-        double reflectT = -1;
-        int nearest = -1;
-        for (int i = 0; i < objects.size(); i++) {
-            double t = objects[i]->intersect(&reflectedRay, nullptr, 0);
-            if (t > 0 && (reflectT < 0 || t < reflectT)) {
-                reflectT = t;
-                nearest = i;
-            }
-        }
-        
-        if (nearest != -1) {
-            double reflectedColor[3] = {0, 0, 0};
-            objects[nearest]->intersect(&reflectedRay, reflectedColor, level + 1);
-            
-            color[0] += reflectedColor[0] * coEfficients[3];
-            color[1] += reflectedColor[1] * coEfficients[3];
-            color[2] += reflectedColor[2] * coEfficients[3];
-        }
-    }
+    shade(r, t, color, level);
     
     return t;
 }
@@ -425,166 +382,114 @@ Vector3D Triangle::getNormal(Vector3D point) {
     return edge1.cross(edge2).normalize();
 }
 
+// Slab test against the bounding box; dimensions given as zero are unbounded (infinite slabs).
+// Quadrics without any bounds skip it.
+bool GeneralQuadric::missesBounds(const Ray* r) const {
+    if (!bounded) return false;
+    const double lo[3] = {boxLo.x, boxLo.y, boxLo.z}, hi[3] = {boxHi.x, boxHi.y, boxHi.z};
+    const double start[3] = {r->start.x, r->start.y, r->start.z}, dir[3] = {r->dir.x, r->dir.y, r->dir.z};
+    double tNear = 0, tFar = INFINITY;
+    for (int a = 0; a < 3; a++) {
+        double inv = 1.0 / dir[a];
+        if (!std::isfinite(inv)) {
+            // Parallel to the slab: inside it for every t or for none. Handled here because
+            // (boundary - start) * inv is 0 * inf = NaN for a ray on a boundary plane.
+            if (start[a] < lo[a] || start[a] > hi[a]) return true;
+            continue;
+        }
+        // Infinite slab sides give infinite distances, never NaN, since inv is finite and nonzero
+        double t0 = (lo[a] - start[a]) * inv, t1 = (hi[a] - start[a]) * inv;
+        tNear = std::max(tNear, std::min(t0, t1));
+        tFar = std::min(tFar, std::max(t0, t1));
+    }
+    return tNear > tFar;
+}
+
+// First root of aq*t^2 + bq*t + cq = 0 in front of the ray whose point is within bounds
+double GeneralQuadric::nearestRoot(Ray* r, double aq, double bq, double cq) {
+    double roots[2];
+    int count = 0;
+    if (fabs(aq) <= 1e-12 * fabs(bq)) {
+        // Ray parallel to an asymptotic direction: a single crossing
+        if (bq == 0) return -1;
+        roots[count++] = -cq / bq;
+    } else {
+        double discriminant = bq * bq - 4 * aq * cq;
+        if (discriminant < 0) return -1; // no intersection
+        double root = sqrt(discriminant);
+        roots[0] = (-bq - root) / (2 * aq);
+        roots[1] = (-bq + root) / (2 * aq);
+        if (roots[0] > roots[1]) std::swap(roots[0], roots[1]);
+        count = 2;
+    }
+
+    // Check which intersection is valid and within bounding box
+    for (int k = 0; k < count; k++) {
+        if (roots[k] > 0 && isWithinBounds(r->start + r->dir * roots[k])) return roots[k];
+    }
+    return -1;
+}
+
 // General Quadric Surface intersection implementation
 double GeneralQuadric::intersect(Ray* r, double* color, int level) {
     // Quadric equation: Ax² + By² + Cz² + Dxy + Exz + Fyz + Gx + Hy + Iz + J = 0
     // Ray: P = r->start + t * r->dir
-    
+    if (missesBounds(r)) return -1;
+
     Vector3D ro = r->start; // ray origin
     Vector3D rd = r->dir;   // ray direction
-    
-    // Substitute ray equation into quadric equation
-    double aq = A * rd.x * rd.x + B * rd.y * rd.y + C * rd.z * rd.z +
-               D * rd.x * rd.y + E * rd.x * rd.z + F * rd.y * rd.z;
-    
-    double bq = 2 * A * ro.x * rd.x + 2 * B * ro.y * rd.y + 2 * C * ro.z * rd.z +
-               D * (ro.x * rd.y + ro.y * rd.x) + E * (ro.x * rd.z + ro.z * rd.x) +
-               F * (ro.y * rd.z + ro.z * rd.y) + G * rd.x + H * rd.y + I * rd.z;
-    
-    double cq = A * ro.x * ro.x + B * ro.y * ro.y + C * ro.z * ro.z +
-               D * ro.x * ro.y + E * ro.x * ro.z + F * ro.y * ro.z +
-               G * ro.x + H * ro.y + I * ro.z + J;
-    
-    double discriminant = bq * bq - 4 * aq * cq;
-    if (discriminant < 0) return -1; // no intersection
-    
-    double t1 = (-bq - sqrt(discriminant)) / (2 * aq);
-    double t2 = (-bq + sqrt(discriminant)) / (2 * aq);
-    
-    double t = -1;
-    
-    // Check which intersection is valid and within bounding box
-    if (t1 > 0) {
-        Vector3D point1 = r->start + r->dir * t1;
-        if (isWithinBounds(point1)) {
-            t = t1;
-        }
-    }
-    if (t < 0 && t2 > 0) {
-        Vector3D point2 = r->start + r->dir * t2;
-        if (isWithinBounds(point2)) {
-            t = t2;
-        }
-    }
-    
-    if (t < 0 || level == 0) return t;
-    
-    // Calculate lighting (similar to other objects)
-    Vector3D intersectionPoint = r->start + r->dir * t;
-    Vector3D normal = getNormal(intersectionPoint);
-    Vector3D intersectionColor = getColorAt(intersectionPoint);
-    
-    // Ambient component
-    color[0] = intersectionColor.x * coEfficients[0];
-    color[1] = intersectionColor.y * coEfficients[0];
-    color[2] = intersectionColor.z * coEfficients[0];
-    
-    // Process each point light
-    for (const auto& light : pointLights) {
-        Vector3D lightDir = (light.light_pos - intersectionPoint).normalize();
-        
-        // Check for shadows
-        Ray shadowRay(intersectionPoint + normal * 0.001, lightDir);
-        bool inShadow = false;
-        
-        for (auto obj : objects) {
-            if (obj != this) {
-                double shadowT = obj->intersect(&shadowRay, nullptr, 0);
-                if (shadowT > 0) {
-                    inShadow = true;
-                    break;
-                }
-            }
-        }
-        
-        if (!inShadow) {
-            // Diffuse component
-            double lambertValue = std::max(0.0, normal.dot(lightDir));
-            color[0] += light.color[0] * coEfficients[1] * lambertValue * intersectionColor.x;
-            color[1] += light.color[1] * coEfficients[1] * lambertValue * intersectionColor.y;
-            color[2] += light.color[2] * coEfficients[1] * lambertValue * intersectionColor.z;
-            
-            // Specular component
-            Vector3D viewDir = (r->start - intersectionPoint).normalize();
-            Vector3D reflectDir = (lightDir * -1 + normal * (2 * normal.dot(lightDir))).normalize();
-            double phongValue = std::max(0.0, viewDir.dot(reflectDir));
-            phongValue = pow(phongValue, shine);
-            
-            color[0] += light.color[0] * coEfficients[2] * phongValue;
-            color[1] += light.color[1] * coEfficients[2] * phongValue;
-            color[2] += light.color[2] * coEfficients[2] * phongValue;
-        }
-    }
-    
-    // Process each spotlight
-    for (const auto& spotlight : spotLights) {
-        Vector3D lightDir = (spotlight.point_light.light_pos - intersectionPoint).normalize();
-        
-        // Check if within cutoff angle
-        Vector3D lightToPoint = (intersectionPoint - spotlight.point_light.light_pos).normalize();
-        double angle = acos(lightToPoint.dot(spotlight.light_direction.normalize())) * 180.0 / M_PI;
-        
-        if (angle <= spotlight.cutoff_angle) {
-            // Check for shadows
-            Ray shadowRay(intersectionPoint + normal * 0.001, lightDir);
-            bool inShadow = false;
-            
-            for (auto obj : objects) {
-                if (obj != this) {
-                    double shadowT = obj->intersect(&shadowRay, nullptr, 0);
-                    if (shadowT > 0) {
-                        inShadow = true;
-                        break;
-                    }
-                }
-            }
-            
-            if (!inShadow) {
-                // Diffuse component
-                double lambertValue = std::max(0.0, normal.dot(lightDir));
-                color[0] += spotlight.point_light.color[0] * coEfficients[1] * lambertValue * intersectionColor.x;
-                color[1] += spotlight.point_light.color[1] * coEfficients[1] * lambertValue * intersectionColor.y;
-                color[2] += spotlight.point_light.color[2] * coEfficients[1] * lambertValue * intersectionColor.z;
-                
-                // Specular component
-                Vector3D viewDir = (r->start - intersectionPoint).normalize();
-                Vector3D reflectDir = (lightDir * -1 + normal * (2 * normal.dot(lightDir))).normalize();
-                double phongValue = std::max(0.0, viewDir.dot(reflectDir));
-                phongValue = pow(phongValue, shine);
-                
-                color[0] += spotlight.point_light.color[0] * coEfficients[2] * phongValue;
-                color[1] += spotlight.point_light.color[1] * coEfficients[2] * phongValue;
-                color[2] += spotlight.point_light.color[2] * coEfficients[2] * phongValue;
-            }
+    double aq, bq, cq;
+
+    switch (form) {
+        case QUADRIC_SPHERE: {
+            Vector3D oc = ro - center;
+            aq = rd.dot(rd);
+            bq = 2 * oc.dot(rd);
+            cq = oc.dot(oc) - shapeParam;
+            break;
         }
-    }
-    
-    // Handle reflection if recursion level allows
-    if (level < recursionLevel && coEfficients[3] > 0) {
-        Vector3D reflectDir = (r->dir - normal * (2 * r->dir.dot(normal))).normalize();
-        Ray reflectedRay(intersectionPoint + reflectDir * 0.0001, reflectDir);
-        
-        // Find nearest intersection for reflected ray
-        double reflectT = -1;
-        int nearest = -1;
-        for (int i = 0; i < objects.size(); i++) {
-            double t = objects[i]->intersect(&reflectedRay, nullptr, 0);
-            if (t > 0 && (reflectT < 0 || t < reflectT)) {
-                reflectT = t;
-                nearest = i;
+        case QUADRIC_CYLINDER:
+        case QUADRIC_CONE: {
+            // Coordinates across the axis (u, v) and along it (w), relative to center
+            Vector3D oc = ro - center;
+            double o[3] = {oc.x, oc.y, oc.z}, d[3] = {rd.x, rd.y, rd.z};
+            int u = (axis + 1) % 3, v = (axis + 2) % 3, w = axis;
+            aq = d[u] * d[u] + d[v] * d[v];
+            bq = 2 * (o[u] * d[u] + o[v] * d[v]);
+            cq = o[u] * o[u] + o[v] * o[v];
+            if (form == QUADRIC_CYLINDER) {
+                cq -= shapeParam;
+            } else {
+                aq -= shapeParam * d[w] * d[w];
+                bq -= 2 * shapeParam * o[w] * d[w];
+                cq -= shapeParam * o[w] * o[w];
             }
+            break;
         }
-        
-        if (nearest != -1) {
-            double reflectedColor[3] = {0, 0, 0};
-            objects[nearest]->intersect(&reflectedRay, reflectedColor, level + 1);
-            
-            color[0] += reflectedColor[0] * coEfficients[3];
-            color[1] += reflectedColor[1] * coEfficients[3];
-            color[2] += reflectedColor[2] * coEfficients[3];
-        }
+        case QUADRIC_PLANE:
+            aq = 0;
+            bq = G * rd.x + H * rd.y + I * rd.z;
+            cq = G * ro.x + H * ro.y + I * ro.z + J;
+            break;
+        default:
+            // Substitute ray equation into quadric equation
+            aq = A * rd.x * rd.x + B * rd.y * rd.y + C * rd.z * rd.z +
+                 D * rd.x * rd.y + E * rd.x * rd.z + F * rd.y * rd.z;
+
+            bq = 2 * A * ro.x * rd.x + 2 * B * ro.y * rd.y + 2 * C * ro.z * rd.z +
+                 D * (ro.x * rd.y + ro.y * rd.x) + E * (ro.x * rd.z + ro.z * rd.x) +
+                 F * (ro.y * rd.z + ro.z * rd.y) + G * rd.x + H * rd.y + I * rd.z;
+
+            cq = A * ro.x * ro.x + B * ro.y * ro.y + C * ro.z * ro.z +
+                 D * ro.x * ro.y + E * ro.x * ro.z + F * ro.y * ro.z +
+                 G * ro.x + H * ro.y + I * ro.z + J;
+            break;
     }
+
+    double t = nearestRoot(r, aq, bq, cq);
+    if (t < 0 || level == 0) return t;
     
+    shade(r, t, color, level);
     
     return t;
 }
@@ -614,3 +519,105 @@ bool GeneralQuadric::isWithinBounds(Vector3D point) {
     }
     return true;
 }
+
+Bounds GeneralQuadric::getBounds() {
+    // Dimensions given as zero are unbounded
+    Vector3D lo(-INFINITY, -INFINITY, -INFINITY), hi(INFINITY, INFINITY, INFINITY);
+    if (cube_length > 0) { lo.x = cube_ref_point.x; hi.x = cube_ref_point.x + cube_length; }
+    if (cube_width > 0)  { lo.y = cube_ref_point.y; hi.y = cube_ref_point.y + cube_width; }
+    if (cube_height > 0) { lo.z = cube_ref_point.z; hi.z = cube_ref_point.z + cube_height; }
+    return Bounds(lo, hi);
+}
+
+void GeneralQuadric::translate(const Vector3D& offset) {
+    // Substitute (x - dx, y - dy, z - dz) into the quadric equation
+    double dx = offset.x, dy = offset.y, dz = offset.z;
+    J = J + A * dx * dx + B * dy * dy + C * dz * dz + D * dx * dy + E * dx * dz + F * dy * dz
+          - G * dx - H * dy - I * dz;
+    G = G - 2 * A * dx - D * dy - E * dz;
+    H = H - 2 * B * dy - D * dx - F * dz;
+    I = I - 2 * C * dz - E * dx - F * dy;
+    cube_ref_point = cube_ref_point + offset;
+    reference_point = reference_point + offset;
+    classify();
+}
+
+// Values equal up to rounding in the scene file
+static bool nearlyEqual(double a, double b) {
+    return fabs(a - b) <= 1e-9 * std::max(1.0, std::max(fabs(a), fabs(b)));
+}
+
+void GeneralQuadric::classify() {
+    // Slabs for the bounding box, padded slightly so hits exactly on a face are still left
+    // to isWithinBounds
+    const double EPS = 1e-6;
+    Bounds box = getBounds();
+    boxLo = box.min - Vector3D(EPS, EPS, EPS);
+    boxHi = box.max + Vector3D(EPS, EPS, EPS);
+    bounded = cube_length > 0 || cube_width > 0 || cube_height > 0;
+
+    form = QUADRIC_GENERAL;
+    center = Vector3D(0, 0, 0);
+    shapeParam = 0;
+    axis = 2;
+
+    bool noCrossTerms = D == 0 && E == 0 && F == 0;
+    if (!noCrossTerms) return;
+
+    double square[3] = {A, B, C}, linear[3] = {G, H, I};
+    if (A == 0 && B == 0 && C == 0) {
+        if (G != 0 || H != 0 || I != 0) form = QUADRIC_PLANE;
+        return;
+    }
+
+    // Complete the squares: sum of square[k] * (x_k - c_k)^2 + rest = 0
+    double c[3] = {0, 0, 0}, rest = J;
+    for (int k = 0; k < 3; k++) {
+        if (square[k] == 0) continue;
+        c[k] = -linear[k] / (2 * square[k]);
+        rest -= square[k] * c[k] * c[k];
+    }
+
+    if (nearlyEqual(A, B) && nearlyEqual(B, C)) {
+        double radius2 = -rest / A;
+        if (radius2 <= 0) return;
+        form = QUADRIC_SPHERE;
+        center = Vector3D(c[0], c[1], c[2]);
+        shapeParam = radius2;
+        return;
+    }
+
+    for (int k = 0; k < 3; k++) {
+        int u = (k + 1) % 3, v = (k + 2) % 3;
+        if (!nearlyEqual(square[u], square[v]) || square[u] == 0) continue;
+
+        // Cylinder: no dependence on the axis coordinate at all
+        if (square[k] == 0 && linear[k] == 0) {
+            double radius2 = -rest / square[u];
+            if (radius2 <= 0) return;
+            form = QUADRIC_CYLINDER;
+            shapeParam = radius2;
+        }
+        // Cone: the axis term has the opposite sign and the apex lies on the surface
+        else if (square[k] != 0 && (square[k] > 0) != (square[u] > 0)
+                 && fabs(rest) <= 1e-9 * (fabs(J) + fabs(square[k] * c[k] * c[k]) + 1)) {
+            form = QUADRIC_CONE;
+            shapeParam = -square[k] / square[u];
+        } else {
+            continue;
+        }
+        axis = k;
+        center = Vector3D(c[0], c[1], c[2]);
+        return;
+    }
+}
+
+const char* quadricFormName(int form) {
+    switch (form) {
+        case QUADRIC_SPHERE: return "sphere";
+        case QUADRIC_CYLINDER: return "cylinder";
+        case QUADRIC_CONE: return "cone";
+        case QUADRIC_PLANE: return "plane";
+        default: return "general";
+    }
+}
@@ -0,0 +1,44 @@
+#include "light_table.h"
+#include <cmath>
+#include <algorithm>
+
+LightTable lightTable;
+
+void LightTable::clear() {
+    posX.clear(); posY.clear(); posZ.clear();
+    colorR.clear(); colorG.clear(); colorB.clear();
+    dirX.clear(); dirY.clear(); dirZ.clear();
+    cosCutoff.clear();
+    type.clear();
+}
+
+void LightTable::add(const Vector3D& pos, const double color[3], const Vector3D& dir, double cosCut, int lightType) {
+    posX.push_back(pos.x); posY.push_back(pos.y); posZ.push_back(pos.z);
+    colorR.push_back(color[0]); colorG.push_back(color[1]); colorB.push_back(color[2]);
+    dirX.push_back(dir.x); dirY.push_back(dir.y); dirZ.push_back(dir.z);
+    cosCutoff.push_back(cosCut);
+    type.push_back(lightType);
+}
+
+void LightTable::addFrom(const LightTable& other, int index) {
+    posX.push_back(other.posX[index]); posY.push_back(other.posY[index]); posZ.push_back(other.posZ[index]);
+    colorR.push_back(other.colorR[index]); colorG.push_back(other.colorG[index]); colorB.push_back(other.colorB[index]);
+    dirX.push_back(other.dirX[index]); dirY.push_back(other.dirY[index]); dirZ.push_back(other.dirZ[index]);
+    cosCutoff.push_back(other.cosCutoff[index]);
+    type.push_back(other.type[index]);
+}
+
+void buildLightTable() {
+    lightTable.clear();
+
+    for (const auto& light : pointLights) {
+        lightTable.add(light.light_pos, light.color, Vector3D(0, 0, 0), -2.0, LIGHT_POINT);
+    }
+
+    // light_direction is normalized by the SpotLight constructor
+    for (const auto& spotlight : spotLights) {
+        double cutoff = std::min(180.0, std::max(0.0, spotlight.cutoff_angle));
+        lightTable.add(spotlight.point_light.light_pos, spotlight.point_light.color,
+                       spotlight.light_direction, cos(cutoff * M_PI / 180.0), LIGHT_SPOT);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef LIGHT_TABLE_H
+#define LIGHT_TABLE_H
+
+#include <vector>
+#include "2005062_classes.h"
+
+enum LightType { LIGHT_POINT = 0, LIGHT_SPOT = 1 };
+
+// Packed structure-of-arrays copy of pointLights followed by spotLights,
+// built once at load so shading can walk every light in one loop
+struct LightTable {
+    std::vector<double> posX, posY, posZ;
+    std::vector<double> colorR, colorG, colorB;
+    std::vector<double> dirX, dirY, dirZ;   // spotlight axis (normalized), zero for point lights
+    std::vector<double> cosCutoff;          // cos(cutoff angle); -2 for point lights so the cone test always passes
+    std::vector<int> type;
+
+    int size() const { return posX.size(); }
+    void clear();
+    void add(const Vector3D& pos, const double color[3], const Vector3D& dir, double cosCut, int lightType);
+    void addFrom(const LightTable& other, int index);
+};
+
+extern LightTable lightTable;
+
+// Rebuild lightTable from pointLights and spotLights
+void buildLightTable();
+
+#endif // LIGHT_TABLE_H
@@ -0,0 +1,240 @@
+#include "light_tree.h"
+#include "light_table.h"
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+LightTree lightTree;
+int lightSampleCount = 0;
+double lightCullThreshold = 0;
+
+static Vector3D lightPosition(int index) {
+    return Vector3D(lightTable.posX[index], lightTable.posY[index], lightTable.posZ[index]);
+}
+
+static double lightPower(int index) {
+    return std::max(lightTable.colorR[index], std::max(lightTable.colorG[index], lightTable.colorB[index]));
+}
+
+// Smallest cone containing cones (axisA, angleA) and (axisB, angleB)
+static void mergeCones(Vector3D axisA, double angleA, Vector3D axisB, double angleB,
+                       Vector3D& axis, double& angle) {
+    if (angleB > angleA) {
+        std::swap(axisA, axisB);
+        std::swap(angleA, angleB);
+    }
+    double between = acos(std::max(-1.0, std::min(1.0, axisA.dot(axisB))));
+    if (std::min(between + angleB, M_PI) <= angleA) {
+        axis = axisA;
+        angle = angleA;
+        return;
+    }
+    angle = (angleA + between + angleB) / 2.0;
+    if (angle >= M_PI) {
+        axis = axisA;
+        angle = M_PI;
+        return;
+    }
+    // Rotate axisA towards axisB so the new cone just covers both
+    double rotation = angle - angleA;
+    Vector3D perpendicular = (axisB - axisA * axisA.dot(axisB)).normalize();
+    axis = (axisA * cos(rotation) + perpendicular * sin(rotation)).normalize();
+}
+
+void LightTree::build() {
+    nodes.clear();
+    int numLights = lightTable.size();
+    if (numLights == 0) return;
+
+    std::vector<int> lights(numLights);
+    for (int i = 0; i < numLights; i++) lights[i] = i;
+    nodes.reserve(2 * numLights - 1);
+    buildRecursive(lights, 0, numLights);
+}
+
+int LightTree::buildRecursive(std::vector<int>& lights, int begin, int end) {
+    int nodeIndex = nodes.size();
+    nodes.push_back(LightTreeNode());
+
+    if (end - begin == 1) {
+        int index = lights[begin];
+        LightTreeNode& leaf = nodes[nodeIndex];
+        leaf.boundsMin = leaf.boundsMax = lightPosition(index);
+        leaf.power = lightPower(index);
+        leaf.left = leaf.right = -1;
+        leaf.lightIndex = index;
+        if (lightTable.type[index] == LIGHT_POINT) {
+            leaf.coneAxis = Vector3D(0, 0, -1);
+            leaf.coneAngle = M_PI;
+        } else {
+            leaf.coneAxis = Vector3D(lightTable.dirX[index], lightTable.dirY[index], lightTable.dirZ[index]);
+            leaf.coneAngle = acos(std::max(-1.0, std::min(1.0, lightTable.cosCutoff[index])));
+        }
+        leaf.cosConeAngle = cos(leaf.coneAngle);
+        leaf.sinConeAngle = sin(leaf.coneAngle);
+        return nodeIndex;
+    }
+
+    // Split at the median along the longest axis of the light positions
+    Vector3D lo = lightPosition(lights[begin]), hi = lo;
+    for (int i = begin + 1; i < end; i++) {
+        Vector3D p = lightPosition(lights[i]);
+        lo = Vector3D(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+        hi = Vector3D(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+    }
+    Vector3D extent = hi - lo;
+    int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+    auto coordinate = [axis](const Vector3D& p) { return axis == 0 ? p.x : (axis == 1 ? p.y : p.z); };
+
+    int mid = (begin + end) / 2;
+    std::nth_element(lights.begin() + begin, lights.begin() + mid, lights.begin() + end,
+                     [&](int a, int b) { return coordinate(lightPosition(a)) < coordinate(lightPosition(b)); });
+
+    int left = buildRecursive(lights, begin, mid);
+    int right = buildRecursive(lights, mid, end);
+
+    // nodes may have been reallocated by the recursive calls
+    const LightTreeNode& l = nodes[left];
+    const LightTreeNode& r = nodes[right];
+    LightTreeNode& node = nodes[nodeIndex];
+    node.boundsMin = Vector3D(std::min(l.boundsMin.x, r.boundsMin.x), std::min(l.boundsMin.y, r.boundsMin.y),
+                              std::min(l.boundsMin.z, r.boundsMin.z));
+    node.boundsMax = Vector3D(std::max(l.boundsMax.x, r.boundsMax.x), std::max(l.boundsMax.y, r.boundsMax.y),
+                              std::max(l.boundsMax.z, r.boundsMax.z));
+    mergeCones(l.coneAxis, l.coneAngle, r.coneAxis, r.coneAngle, node.coneAxis, node.coneAngle);
+    node.cosConeAngle = cos(node.coneAngle);
+    node.sinConeAngle = sin(node.coneAngle);
+    node.power = l.power + r.power;
+    node.left = left;
+    node.right = right;
+    node.lightIndex = -1;
+    return nodeIndex;
+}
+
+// Upper bound on the summed contribution of a subtree at a shading point.
+// Lights have no distance falloff in this renderer, so the bound is the
+// subtree power, zeroed when no spotlight cone can reach the point and
+// with the diffuse part zeroed when every light is below the surface.
+double LightTree::importance(const LightTreeNode& node, const Vector3D& point, const Vector3D& normal,
+                             double diffuse, double specular) const {
+    Vector3D center = (node.boundsMin + node.boundsMax) * 0.5;
+    double radius = (node.boundsMax - node.boundsMin).length() * 0.5;
+    Vector3D toPoint = point - center;
+    double distance = toPoint.length();
+    if (distance <= radius) return node.power * (diffuse + specular);
+
+    // Angle subtended by the node bounds as seen from the point (compared via sin/cos to avoid acos)
+    double sinBounds = radius / distance;
+    double cosBounds = sqrt(1.0 - sinBounds * sinBounds);
+
+    // No spotlight cone widened by the bounds angle reaches the point
+    if (node.coneAngle < M_PI) {
+        double cosAngle = node.coneAxis.dot(toPoint) / distance;
+        double cosLimit = node.cosConeAngle * cosBounds - node.sinConeAngle * sinBounds;
+        double sinLimit = node.sinConeAngle * cosBounds + node.cosConeAngle * sinBounds;
+        if (sinLimit >= 0 && cosAngle < cosLimit) return 0; // widened cone still below M_PI
+    }
+
+    // Every light in the bounds is below the surface
+    double facing = 1.0;
+    if (-normal.dot(toPoint) / distance <= -sinBounds) facing = 0;
+
+    return node.power * (diffuse * facing + specular);
+}
+
+// Walk from the root choosing children in proportion to their importance
+bool LightTree::sampleOne(const Vector3D& point, const Vector3D& normal, double diffuse, double specular,
+                          double u, int& lightIndex, double& pdf) const {
+    int current = 0;
+    pdf = 1.0;
+    if (importance(nodes[0], point, normal, diffuse, specular) <= 0) return false;
+
+    while (nodes[current].lightIndex < 0) {
+        const LightTreeNode& node = nodes[current];
+        double wl = importance(nodes[node.left], point, normal, diffuse, specular);
+        double wr = importance(nodes[node.right], point, normal, diffuse, specular);
+        if (wl + wr <= 0) return false;
+
+        double pl = wl / (wl + wr);
+        if (u < pl) {
+            u = u / pl;
+            pdf *= pl;
+            current = node.left;
+        } else {
+            u = (u - pl) / (1.0 - pl);
+            pdf *= 1.0 - pl;
+            current = node.right;
+        }
+    }
+    lightIndex = nodes[current].lightIndex;
+    return true;
+}
+
+void LightTree::cullRecursive(int nodeIndex, const Vector3D& point, const Vector3D& normal,
+                              double diffuse, double specular, std::vector<LightSample>& out) const {
+    const LightTreeNode& node = nodes[nodeIndex];
+    if (importance(node, point, normal, diffuse, specular) < lightCullThreshold) return;
+
+    if (node.lightIndex >= 0) {
+        out.push_back({node.lightIndex, 1.0});
+        return;
+    }
+    cullRecursive(node.left, point, normal, diffuse, specular, out);
+    cullRecursive(node.right, point, normal, diffuse, specular, out);
+}
+
+// Per-thread xorshift generator, reseeded for every pixel by seedLightSampling
+static thread_local uint64_t randomState = 0x9E3779B97F4A7C15ULL;
+
+void seedLightSampling(int i, int j, int sample) {
+    // splitmix64 finalizer over the packed coordinates; never leaves xorshift at zero
+    uint64_t z = ((uint64_t)(uint32_t)i << 32 | (uint32_t)j) ^ ((uint64_t)sample * 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    randomState = z ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+// Uniform in [0, 1)
+static double nextRandom() {
+    uint64_t& state = randomState;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return ((state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+bool LightTree::usesAllLights() const {
+    if (nodes.empty()) return true;
+    if (lightSampleCount > 0 && lightSampleCount < lightTable.size()) return false;
+    return lightCullThreshold <= 0;
+}
+
+void LightTree::gatherLights(const Vector3D& point, const Vector3D& normal,
+                             double diffuse, double specular, std::vector<LightSample>& out) const {
+    out.clear();
+    int numLights = lightTable.size();
+    if (numLights == 0) return;
+
+    if (usesAllLights()) {
+        for (int i = 0; i < numLights; i++) out.push_back({i, 1.0});
+        return;
+    }
+
+    if (lightSampleCount > 0 && lightSampleCount < numLights) {
+        for (int s = 0; s < lightSampleCount; s++) {
+            int index;
+            double pdf;
+            if (sampleOne(point, normal, diffuse, specular, nextRandom(), index, pdf)) {
+                out.push_back({index, 1.0 / (lightSampleCount * pdf)});
+            }
+        }
+        return;
+    }
+
+    cullRecursive(0, point, normal, diffuse, specular, out);
+}
+
+void buildLightTree() {
+    lightTree.build();
+}
@@ -0,0 +1,64 @@
+#ifndef LIGHT_TREE_H
+#define LIGHT_TREE_H
+
+#include <vector>
+#include "2005062_classes.h"
+
+// Lights are identified by their index in lightTable (point lights first, then spotlights)
+
+// A light picked for one shading point, with the weight its contribution gets
+struct LightSample {
+    int index;
+    double weight;
+};
+
+// Node of the light hierarchy (bounds, emission cone and total power of a subtree)
+struct LightTreeNode {
+    Vector3D boundsMin, boundsMax;
+    Vector3D coneAxis;      // average emission direction
+    double coneAngle;       // half-angle (radians) bounding all emission directions, M_PI = every direction
+    double cosConeAngle, sinConeAngle;
+    double power;           // sum of the brightest color channel of each light
+    int left, right;        // child nodes, -1 on leaves
+    int lightIndex;         // light stored in a leaf, -1 on inner nodes
+};
+
+// Bounding volume hierarchy over the entries of lightTable
+class LightTree {
+public:
+    std::vector<LightTreeNode> nodes;
+
+    // Rebuild over the current lightTable
+    void build();
+
+    // True when neither sampling nor culling is active, so every light is evaluated with weight 1
+    bool usesAllLights() const;
+
+    // Fill 'out' with the lights to evaluate at a point.
+    // lightSampleCount > 0: pick that many lights by importance, weighted by 1/(count * pdf) (unbiased)
+    // lightCullThreshold > 0: keep every light whose bounded contribution reaches the threshold, weight 1
+    // otherwise: every light with weight 1
+    void gatherLights(const Vector3D& point, const Vector3D& normal,
+                      double diffuse, double specular, std::vector<LightSample>& out) const;
+
+private:
+    int buildRecursive(std::vector<int>& lights, int begin, int end);
+    double importance(const LightTreeNode& node, const Vector3D& point, const Vector3D& normal,
+                      double diffuse, double specular) const;
+    bool sampleOne(const Vector3D& point, const Vector3D& normal, double diffuse, double specular,
+                   double u, int& lightIndex, double& pdf) const;
+    void cullRecursive(int nodeIndex, const Vector3D& point, const Vector3D& normal,
+                       double diffuse, double specular, std::vector<LightSample>& out) const;
+};
+
+extern LightTree lightTree;
+extern int lightSampleCount;        // lights sampled per shading point, 0 = all lights
+extern double lightCullThreshold;   // deterministic culling threshold, 0 = off
+
+void buildLightTree();
+
+// Restart this thread's light sampling sequence for sample 'sample' of pixel (i, j), so
+// sampled renders don't depend on which worker renders which tile
+void seedLightSampling(int i, int j, int sample);
+
+#endif // LIGHT_TREE_H
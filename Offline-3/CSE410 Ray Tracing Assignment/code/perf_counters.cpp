@@ -0,0 +1,129 @@
+#include "perf_counters.h"
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+bool perfCountersEnabled = false;
+
+static std::mutex reasonMutex;
+static std::string unavailableReason = "not opened";
+
+const char* perfEventName(int event) {
+    switch (event) {
+        case PERF_CYCLES: return "cycles";
+        case PERF_INSTRUCTIONS: return "instructions";
+        case PERF_L1D_MISSES: return "L1D misses";
+        case PERF_LLC_MISSES: return "LLC misses";
+        default: return "branch misses";
+    }
+}
+
+PerfReading PerfReading::operator-(const PerfReading& other) const {
+    PerfReading difference;
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) difference.value[k] = value[k] - other.value[k];
+    return difference;
+}
+
+PerfReading& PerfReading::operator+=(const PerfReading& other) {
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) value[k] += other.value[k];
+    return *this;
+}
+
+bool PerfCounters::anyOpen() const {
+    for (int fd : fds) {
+        if (fd >= 0) return true;
+    }
+    return false;
+}
+
+#ifdef __linux__
+
+bool PerfCounters::open(bool inherit) {
+    close();
+    const uint32_t type[PERF_EVENT_COUNT] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+                                             PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE};
+    const uint64_t config[PERF_EVENT_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+    int error = 0;
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type[k];
+        attr.config = config[k];
+        attr.exclude_kernel = 1;    // allowed at perf_event_paranoid 2
+        attr.exclude_hv = 1;
+        attr.inherit = inherit;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds[k] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fds[k] < 0) error = errno;
+    }
+
+    std::lock_guard<std::mutex> lock(reasonMutex);
+    if (anyOpen()) {
+        unavailableReason.clear();
+        return true;
+    }
+    if (!unavailableReason.empty()) {
+        unavailableReason = std::string("perf_event_open: ") + strerror(error);
+        if (error == EACCES || error == EPERM) unavailableReason += " (see /proc/sys/kernel/perf_event_paranoid)";
+        else if (error == ENOENT || error == EOPNOTSUPP) unavailableReason += " (no hardware counters, e.g. in a VM)";
+    }
+    return false;
+}
+
+void PerfCounters::close() {
+    for (int& fd : fds) {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+}
+
+PerfReading PerfCounters::read() const {
+    PerfReading reading;
+    for (int k = 0; k < PERF_EVENT_COUNT; k++) {
+        uint64_t data[3];   // value, time enabled, time running
+        if (fds[k] < 0 || ::read(fds[k], data, sizeof(data)) != sizeof(data)) continue;
+        reading.value[k] = data[2] > 0 && data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+    }
+    return reading;
+}
+
+#else
+
+bool PerfCounters::open(bool inherit) {
+    std::lock_guard<std::mutex> lock(reasonMutex);
+    unavailableReason = "hardware counters need Linux perf_event_open";
+    return false;
+}
+
+void PerfCounters::close() {}
+
+PerfReading PerfCounters::read() const { return PerfReading(); }
+
+#endif
+
+PerfReading readThreadCounters() {
+    if (!perfCountersEnabled) return PerfReading();
+    static thread_local PerfCounters counters;
+    static thread_local bool opened = false;
+    if (!opened) {
+        counters.open(false);
+        opened = true;
+    }
+    return counters.read();
+}
+
+std::string perfUnavailableReason() {
+    std::lock_guard<std::mutex> lock(reasonMutex);
+    return unavailableReason;
+}
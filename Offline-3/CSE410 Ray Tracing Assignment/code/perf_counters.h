@@ -0,0 +1,59 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+// Hardware events counted with perf_event_open (Linux only)
+enum PerfEvent {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,        // L1 data cache read misses
+    PERF_LLC_MISSES,        // last level cache misses
+    PERF_BRANCH_MISSES,
+    PERF_EVENT_COUNT
+};
+
+const char* perfEventName(int event);
+
+// Counter values at one moment, or the difference of two such readings
+struct PerfReading {
+    uint64_t value[PERF_EVENT_COUNT] = {};
+
+    PerfReading operator-(const PerfReading& other) const;
+    PerfReading& operator+=(const PerfReading& other);
+    double ipc() const { return value[PERF_CYCLES] ? (double)value[PERF_INSTRUCTIONS] / value[PERF_CYCLES] : 0; }
+};
+
+// The events, counted in user space for the thread that opened them. With inherit, threads
+// it starts afterwards are counted too, once they have exited.
+class PerfCounters {
+public:
+    PerfCounters() = default;
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    ~PerfCounters() { close(); }
+
+    // Events the kernel refuses stay off and read as 0; false if none could be opened
+    bool open(bool inherit);
+    void close();
+    bool isOpen(int event) const { return fds[event] >= 0; }
+    bool anyOpen() const;
+
+    // Current values, scaled up when the kernel multiplexed an event
+    PerfReading read() const;
+
+private:
+    int fds[PERF_EVENT_COUNT] = {-1, -1, -1, -1, -1};
+};
+
+// Off by default; turn on before rendering to have tiles read their thread's counters
+extern bool perfCountersEnabled;
+
+// Counters of the calling thread, opened on its first call; zeros when disabled or unavailable
+PerfReading readThreadCounters();
+
+// Why no counter could be opened (e.g. perf_event_paranoid), empty once one has been
+std::string perfUnavailableReason();
+
+#endif // PERF_COUNTERS_H
@@ -1,8 +1,24 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <thread>
+#include <chrono>
 #include "stb_image.h"
 #include "2005062_classes.h"
+#include "light_table.h"
+#include "light_tree.h"
+#include "scene.h"
+#include "bvh.h"
+#include "renderer.h"
+#include "checkpoint.h"
+#include "budget.h"
+#include "tiled_output.h"
+#include "image_io.h"
+#include "tile_cache.h"
+#include "render_stats.h"
+#include "perf_counters.h"
+#include "heatmap.h"
+#include "trace.h"
 using namespace std;
 
 // Global variables
@@ -46,9 +62,7 @@ void loadData() {
     }
     
     // Clear existing data
-    objects.clear();
-    pointLights.clear();
-    spotLights.clear();
+    clearScene();
     
     // Read recursion level and image dimensions
     file >> recursionLevel;
@@ -74,7 +88,7 @@ void loadData() {
             file >> amb >> diff >> spec >> refl;
             file >> shine;
             
-            Sphere* sphere = new Sphere(Vector3D(cx, cy, cz), radius);
+            Sphere* sphere = sceneArena.make<Sphere>(Vector3D(cx, cy, cz), radius);
             sphere->setColor(r, g, b);
             sphere->setCoEfficients(amb, diff, spec, refl);
             sphere->setShine(shine);
@@ -93,9 +107,9 @@ void loadData() {
             file >> amb >> diff >> spec >> refl;
             file >> shine;
             
-            Triangle* triangle = new Triangle(Vector3D(x1, y1, z1), 
-                                            Vector3D(x2, y2, z2), 
-                                            Vector3D(x3, y3, z3));
+            Triangle* triangle = sceneArena.make<Triangle>(Vector3D(x1, y1, z1), 
+                                                           Vector3D(x2, y2, z2),
+                                                           Vector3D(x3, y3, z3));
             triangle->setColor(r, g, b);
             triangle->setCoEfficients(amb, diff, spec, refl);
             triangle->setShine(shine);
@@ -116,17 +130,21 @@ void loadData() {
             file >> amb >> diff >> spec >> refl;
             file >> shine;
             
-            GeneralQuadric* quad = new GeneralQuadric(coeffs, Vector3D(ref_x, ref_y, ref_z), 
-                                                     length, width, height);
+            GeneralQuadric* quad = sceneArena.make<GeneralQuadric>(coeffs, Vector3D(ref_x, ref_y, ref_z), 
+                                                                   length, width, height);
             quad->setColor(r, g, b);
             quad->setCoEfficients(amb, diff, spec, refl);
             quad->setShine(shine);
+            if (quad->form != QUADRIC_GENERAL) {
+                cout << "Quadric " << objects.size() << " is a " << quadricFormName(quad->form)
+                     << ", using its specialized intersection" << endl;
+            }
             objects.push_back(quad);
         }
     }
     
     // Add floor
-    Floor* floor = new Floor(1000, 20);
+    Floor* floor = sceneArena.make<Floor>(1000, 20);
     floor->setColor(1, 1, 1);
     floor->setCoEfficients(0.4, 0.2, 0.2, 0.2);
     floor->setShine(1);
@@ -164,6 +182,10 @@ void loadData() {
     
     file.close();
     
+    finalizeScene();
+    buildLightTable();
+    buildLightTree();
+    
     int sp = 0, t = 0, q = 0;
     for (auto obj : objects) {
         if (dynamic_cast<Sphere*>(obj)) sp++;
@@ -181,101 +203,463 @@ void showProgress(int percentage) {
     fflush(stdout);
 }
 
-// Capture function for ray tracing
-void capture(string outputFile = "") {
-    bitmap_image image(imageWidth, imageHeight);
-    
-    // Set background color
-    for (int i = 0; i < imageWidth; i++) {
-        for (int j = 0; j < imageHeight; j++) {
-            image.set_pixel(i, j, 0, 0, 0);
-        }
+// Current camera for the renderer
+Camera currentCamera() {
+    return Camera{eye, look, up, rightV, viewAngle, windowWidth, windowHeight};
+}
+
+// Rasterize primary visibility instead of casting primary rays (--hybrid)
+bool hybridRender = false;
+
+// Tile workers (--threads) and checkpointing (--checkpoint, --resume)
+int renderThreads = 1;
+string checkpointFile = "";
+bool resumeRender = false;
+
+// Time budget in milliseconds from program start (--time-budget), 0 for none
+double timeBudgetMs = 0;
+chrono::steady_clock::time_point programStart = chrono::steady_clock::now();
+
+// Render a .bmp output through a memory-mapped file (--mmap)
+bool mappedOutput = false;
+
+// Downsampled copy of a streamed (.tif/.raw/--mmap) render (--preview)
+string previewFile = "";
+
+// Tile and in-tile pixel order (--tile-order, --pixel-order)
+TraversalOrder tileOrder = ORDER_HILBERT;
+TraversalOrder pixelOrder = ORDER_MORTON;
+
+// Timing and ray counts, printed at the end with --stats
+bool printStats = false;
+RenderStats renderStats;
+
+// Hardware counters for the stats report (--perf): the whole process per phase, and each tile
+PerfCounters processCounters;
+PerfReading loadHardware, frameHardware;
+
+// Chrome trace of the run (--trace)
+string traceFile = "";
+
+// Per-tile frustum culling of primary rays, off with --no-frustum-cull
+bool frustumCulling = true;
+
+// Per-pixel cost heatmaps written next to the image (--heatmaps)
+bool writeHeatmaps = false;
+CostMaps costMaps;
+
+// Options every render path shares
+RenderOptions baseOptions() {
+    RenderOptions options;
+    options.hybrid = hybridRender;
+    options.threads = renderThreads;
+    options.tileOrder = tileOrder;
+    options.pixelOrder = pixelOrder;
+    options.stats = &renderStats;
+    options.frustumCulling = frustumCulling;
+    return options;
+}
+
+void reportHardwareCounters(uint64_t rays) {
+    if (!processCounters.anyOpen()) {
+        printf("  hw counters     unavailable, %s\n", perfUnavailableReason().c_str());
+        return;
     }
-    
+    auto count = [](const PerfReading& reading, int event) {
+        return processCounters.isOpen(event) ? to_string(reading.value[event]) : string("-");
+    };
+    printf("  hw counters     %-12s %14s %14s %6s %12s %12s %12s\n", "", "cycles", "instructions", "IPC", "L1D misses",
+           "LLC misses", "br. misses");
+    auto row = [&](const char* phase, const PerfReading& reading) {
+        printf("    %-25s %14s %14s %6.2f %12s %12s %12s\n", phase, count(reading, PERF_CYCLES).c_str(),
+               count(reading, PERF_INSTRUCTIONS).c_str(), reading.ipc(), count(reading, PERF_L1D_MISSES).c_str(),
+               count(reading, PERF_LLC_MISSES).c_str(), count(reading, PERF_BRANCH_MISSES).c_str());
+    };
+    row("scene load + accel build", loadHardware);
+    row("frame (render + encode)", frameHardware);
+    row("tiles", renderStats.hardware);
+
+    const PerfReading& tiles = renderStats.hardware;
+    printf("  per ray         %.0f cycles, %.3f L1D misses, %.3f LLC misses, %.3f branch misses\n",
+           (double)tiles.value[PERF_CYCLES] / rays, (double)tiles.value[PERF_L1D_MISSES] / rays,
+           (double)tiles.value[PERF_LLC_MISSES] / rays, (double)tiles.value[PERF_BRANCH_MISSES] / rays);
+
+    // Spread over tiles, to spot the expensive ones
+    vector<PerfReading> perTile = renderStats.tileHardware;
+    if (perTile.empty()) return;
+    vector<double> ipc;
+    uint64_t maxCycles = 0;
+    for (const PerfReading& tile : perTile) {
+        ipc.push_back(tile.ipc());
+        maxCycles = max(maxCycles, tile.value[PERF_CYCLES]);
+    }
+    sort(ipc.begin(), ipc.end());
+    sort(perTile.begin(), perTile.end(), [](const PerfReading& a, const PerfReading& b) {
+        return a.value[PERF_CYCLES] < b.value[PERF_CYCLES];
+    });
+    uint64_t medianCycles = perTile[perTile.size() / 2].value[PERF_CYCLES];
+    printf("  tile IPC        min %.2f, median %.2f, max %.2f; costliest tile %.1fx the median cycles\n", ipc.front(),
+           ipc[ipc.size() / 2], ipc.back(), medianCycles ? (double)maxCycles / medianCycles : 0.0);
+}
+
+void reportStats() {
+    double seconds = renderStats.renderSeconds;
+    cout << "Render stats:" << endl;
+    printf("  traversal       %s tiles, %s pixels\n", traversalOrderName(tileOrder), traversalOrderName(pixelOrder));
+    printf("  object order    %s\n", reorderObjects ? "morton" : "file");
+    printf("  threads         %d\n", renderThreads);
+    printf("  scene load      %.1f ms, %.1f KB of objects in %d arena blocks\n", renderStats.loadSeconds * 1000,
+           sceneArena.bytesUsed() / 1024.0, sceneArena.blockCount());
+    printf("  render          %.1f ms, %llu tiles\n", seconds * 1000, (unsigned long long)renderStats.tiles);
+    printf("  accel           %s", accelLayoutName(sceneBVH.layout));
+    if (sceneBVH.layout != ACCEL_NONE) {
+        printf(", %d nodes, %.1f KB, %.1f bytes per primitive", sceneBVH.nodeCount(), sceneBVH.nodeBytes() / 1024.0,
+               sceneBVH.boundedCount() ? (double)sceneBVH.nodeBytes() / sceneBVH.boundedCount() : 0.0);
+        printf("\n  accel build     %.1f ms, %s on %d threads", sceneBVH.buildSeconds * 1000,
+               buildMethodName(sceneBVH.buildMethod), sceneBVH.buildThreads);
+    }
+    printf("\n");
+    printf("  primary rays    %llu\n", (unsigned long long)renderStats.pixels);
+    if (renderStats.culledTiles > 0) {
+        printf("  frustum culling %llu of %llu tiles traced against their own objects, %llu of them empty\n",
+               (unsigned long long)renderStats.culledTiles, (unsigned long long)renderStats.tiles,
+               (unsigned long long)renderStats.emptyTiles);
+    }
+    printf("  closest-hit     %llu (primary + reflection)\n", (unsigned long long)renderStats.rays.nearest);
+    printf("  shadow rays     %llu\n", (unsigned long long)renderStats.rays.shadow);
+    uint64_t rays = max<uint64_t>(1, renderStats.totalRays());
+    printf("  per ray         %.2f node visits, %.2f primitive tests\n", (double)renderStats.rays.nodeVisits / rays,
+           (double)renderStats.rays.primitiveTests / rays);
+    if (seconds > 0) {
+        printf("  throughput      %.3f Mrays/s, %.3f Mpixels/s\n", renderStats.totalRays() / seconds / 1e6,
+               renderStats.pixels / seconds / 1e6);
+    }
+    if (perfCountersEnabled) reportHardwareCounters(rays);
+}
+
+// Render straight to a tiled file without holding the frame in memory
+bool captureStreamed(const string& outputFile, TiledImageWriter& writer) {
     updateCameraVectors();
-    
-    // Calculate plane distance and setup
-    double planeDistance = (windowHeight / 2.0) / tan((viewAngle * M_PI / 180.0) / 2.0);
-    Vector3D topleft = eye + look * planeDistance - rightV * (windowWidth / 2.0) + up * (windowHeight / 2.0);
-    
-    double du = (double)windowWidth / imageWidth;
-    double dv = (double)windowHeight / imageHeight;
-    
-    topleft = topleft + rightV * (0.5 * du) - up * (0.5 * dv);
-    
-    // Ray tracing loop
-    for (int i = 0; i < imageWidth; i++) {
-        for (int j = 0; j < imageHeight; j++) {
-            Vector3D curPixel = topleft + rightV * (i * du) - up * (j * dv);
-            Vector3D rayDir = (curPixel - eye).normalize();
-            
-            Ray ray(eye, rayDir);
-            
-            double tMin = -1;
-            int nearest = -1;
-            
-            for (int k = 0; k < objects.size(); k++) {
-                double t = objects[k]->intersect(&ray, nullptr, 0);
-                if (t > 0 && (tMin < 0 || t < tMin)) {
-                    tMin = t;
-                    nearest = k;
-                }
-            }
-            
-            if (nearest != -1) {
-                double color[3] = {0.0, 0.0, 0.0};
-                objects[nearest]->intersect(&ray, color, 1);
-                
-                int r = (int)(clamp(color[0], 0.0, 1.0) * 255);
-                int g = (int)(clamp(color[1], 0.0, 1.0) * 255);
-                int b = (int)(clamp(color[2], 0.0, 1.0) * 255);
-                
-                image.set_pixel(i, j, r, g, b);
+    if (!writer.open(outputFile, imageWidth, imageHeight, STREAM_TILE_SIZE)) {
+        cout << "Cannot write " << outputFile << endl;
+        return false;
+    }
+
+    RenderOptions options = baseOptions();
+    bitmap_image preview;
+    if (!renderTiled(currentCamera(), imageWidth, imageHeight, STREAM_TILE_SIZE, writer,
+                     previewFile.empty() ? nullptr : &preview, options)) {
+        cout << "\nError writing " << outputFile << endl;
+        return false;
+    }
+    cout << "\nImage saved as " << outputFile << endl;
+
+    if (!previewFile.empty()) {
+        preview.save_image(previewFile);
+        cout << "Preview saved as " << previewFile << " (" << preview.width() << "x" << preview.height() << ")" << endl;
+    }
+    return true;
+}
+
+// Identifies a render for its checkpoint: scene file contents and the options that change pixels
+uint64_t renderJobKey() {
+    uint64_t hash = 14695981039346656037ULL;    // FNV-1a
+    auto mix = [&hash](const string& bytes) {
+        for (unsigned char c : bytes) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+    };
+    ifstream file(sceneFile, ios::binary);
+    stringstream contents;
+    contents << file.rdbuf();
+    mix(contents.str());
+    mix(to_string(lightSampleCount) + " " + to_string(lightCullThreshold) + " " + to_string(hybridRender) + " "
+        + to_string(reorderObjects));
+    return hash;
+}
+
+// Compare encode + write throughput of every output format on the rendered image (--encode-benchmark)
+bool encoderBenchmark = false;
+
+void benchmarkEncoders(const bitmap_image& image, vector<Vector3D> hdrPixels, const string& outputFile) {
+    int width = image.width(), height = image.height();
+    if (hdrPixels.empty()) {
+        hdrPixels.resize(width * height);
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                unsigned char r, g, b;
+                image.get_pixel(i, j, r, g, b);
+                hdrPixels[j * width + i] = Vector3D(r, g, b) * (1.0 / 255);
             }
         }
-        
-        if (i % 50 == 0) {
-            showProgress(i * 100 / imageWidth);
+    }
+
+    const int RUNS = 5;
+    double pixelMB = width * height * 3 / 1e6;
+    cout << "Encoder benchmark, " << width << "x" << height << ", best of " << RUNS << " runs:" << endl;
+    printf("  %-6s %10s %10s %12s\n", "format", "size (KB)", "time (ms)", "MB/s (RGB8)");
+    for (const char* extension : {".bmp", ".qoi", ".png", ".pfm", ".exr"}) {
+        string path = outputFile + ".bench" + extension;
+        double best = 1e30;
+        for (int run = 0; run < RUNS; run++) {
+            auto start = chrono::steady_clock::now();
+            if (isHdrFormat(imageFormatFor(path))) saveHdrImage(hdrPixels, width, height, path);
+            else saveImage(image, path);
+            best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
         }
+        ifstream written(path, ios::binary | ios::ate);
+        printf("  %-6s %10.1f %10.2f %12.1f\n", imageFormatName(imageFormatFor(path)),
+               written.tellg() / 1024.0, best, pixelMB / (best / 1000));
+        written.close();
+        remove(path.c_str());
     }
-    
-    showProgress(100);
-    
-    // Save image
+}
+
+// Capture function for ray tracing; false if nothing was saved
+bool capture(string outputFile = "") {
     if (outputFile.empty()) {
         static int imageCount = 1;
         outputFile = "Output_" + to_string(imageCount) + ".bmp";
         imageCount++;
     }
+
+    // Tiled formats (and mapped BMPs) are streamed; the full frame never exists in memory
+    TiledImageWriter* writer = tiledWriterFor(outputFile);
+    if (!writer && mappedOutput && imageFormatFor(outputFile) == FORMAT_BMP) writer = new MappedBmpWriter();
+    if (writeHeatmaps && (writer || timeBudgetMs > 0)) {
+        cout << "Heatmaps are only written for regular renders, not streamed or time-budgeted ones" << endl;
+    }
+    bool checkpointRequested = !checkpointFile.empty() || resumeRender;
+    if (checkpointRequested && (writer || timeBudgetMs > 0)) {
+        cout << "Warning: checkpoints are only kept for regular renders; --checkpoint and --resume are ignored "
+             << "for streamed and time-budgeted ones" << endl;
+    }
+    if (hybridRender && writer) {
+        cout << "Warning: streamed outputs are ray traced tile by tile; --hybrid is ignored for them" << endl;
+    }
+    if (writer) {
+        bool saved = captureStreamed(outputFile, *writer);
+        delete writer;
+        return saved;
+    }
+
+    bitmap_image image(imageWidth, imageHeight);
     
-    image.save_image(outputFile);
-    cout << "\nImage saved as " << outputFile << endl;
+    // Set background color
+    image.set_all_channels(0, 0, 0);
+
+    updateCameraVectors();
+    RenderOptions options = baseOptions();
+
+    // Budgeted renders are short; they refine in passes and skip checkpointing
+    if (timeBudgetMs > 0) {
+        auto deadline = programStart + chrono::microseconds((long long)(timeBudgetMs * 1000));
+        BudgetReport report = renderWithBudget(currentCamera(), image, deadline, options);
+        double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - programStart).count();
+
+        saveImage(image, outputFile);
+        ofstream meta(outputFile + ".json");
+        meta << "{\"quality_tier\": \"" << qualityTierName(report.tier) << "\", \"samples_per_pixel\": "
+             << report.samples << ", \"time_budget_ms\": " << timeBudgetMs << ", \"elapsed_ms\": "
+             << elapsedMs << "}" << endl;
+        cout << "\nImage saved as " << outputFile << " (quality: " << qualityTierName(report.tier);
+        if (report.samples > 1) cout << ", " << report.samples << " samples per pixel";
+        cout << ", " << elapsedMs << " ms)" << endl;
+        return true;
+    }
+
+    // Float formats keep the unclamped colors, collected as a one-sample accumulation
+    bool hdr = isHdrFormat(imageFormatFor(outputFile));
+    vector<Vector3D> hdrPixels;
+    if (hdr) {
+        hdrPixels.assign(imageWidth * imageHeight, Vector3D(0, 0, 0));
+        options.accumulation = &hdrPixels;
+    }
+
+    // With --checkpoint or --resume, finished tiles go to a checkpoint until the image is saved
+    Checkpoint checkpoint;
+    bool checkpointing = false;
+    if (checkpointRequested) {
+        string checkpointPath = checkpointFile.empty() ? outputFile + ".ckpt" : checkpointFile;
+        uint64_t jobKey = renderJobKey();
+        if (!resumeRender && Checkpoint::holdsJob(checkpointPath, jobKey, image, TileCache::TILE_SIZE, hdr)) {
+            cout << "Error: " << checkpointPath << " holds finished tiles of this render; add --resume to continue it"
+                 << " or delete the file to start over" << endl;
+            return false;
+        }
+        checkpointing = checkpoint.open(checkpointPath, jobKey, image, TileCache::TILE_SIZE, resumeRender,
+                                        hdr ? &hdrPixels : nullptr);
+        if (!checkpointing) {
+            cout << "Warning: cannot write checkpoint " << checkpointPath << endl;
+        } else if (checkpoint.doneCount() > 0) {
+            cout << "Resuming with " << checkpoint.doneCount() << " finished tiles from " << checkpointPath << endl;
+        }
+    }
+
+    options.checkpoint = checkpointing ? &checkpoint : nullptr;
+    int resumedTiles = checkpointing ? checkpoint.doneCount() : 0;
+    if (writeHeatmaps) options.costMaps = &costMaps;
+    renderImage(currentCamera(), image, options);
+    
+    // Save image
+    auto encodeStart = chrono::steady_clock::now();
+    bool saved = hdr ? saveHdrImage(hdrPixels, imageWidth, imageHeight, outputFile) : saveImage(image, outputFile);
+    auto encodeEnd = chrono::steady_clock::now();
+    if (traceEnabled) traceSpan("encode image", "output", encodeStart, encodeEnd);
+    double encodeMs = chrono::duration<double, milli>(encodeEnd - encodeStart).count();
+    if (!saved) {
+        cout << "\nError writing " << outputFile << endl;
+        return false;
+    }
+    if (checkpointing) checkpoint.remove();
+    cout << "\nImage saved as " << outputFile << " (" << imageFormatName(imageFormatFor(outputFile))
+         << ", written in " << encodeMs << " ms)" << endl;
+
+    if (writeHeatmaps) {
+        if (resumedTiles > 0) cout << "Heatmaps are zero over the tiles resumed from the checkpoint" << endl;
+        saveHeatmaps(costMaps, outputFile);
+    }
+    if (encoderBenchmark) benchmarkEncoders(image, hdrPixels, outputFile);
+    return true;
+}
+
+void printUsage(const char* program) {
+    cout << "Usage: " << program << " <scene_file> [output_file] [options]" << endl;
+    cout << "Example: " << program << " scene.txt output.bmp" << endl;
+    cout << "The output format follows the extension: .bmp, .png, .qoi, or .pfm/.exr for unclamped float color" << endl;
+    cout << "Outputs ending in .tif (BigTIFF) or .raw (tiles plus a .idx index) are streamed to disk tile by tile" << endl;
+    cout << "Options:" << endl;
+    cout << "  --light-samples N   sample N lights per shading point by importance (0 = all lights)" << endl;
+    cout << "  --light-cull T      skip lights whose bounded contribution is below T" << endl;
+    cout << "  --hybrid            rasterize primary visibility, ray trace shadows and reflections" << endl;
+    cout << "  --threads N         render tiles on N threads (0 = all cores)" << endl;
+    cout << "  --checkpoint FILE   save finished tiles to FILE (default: <output_file>.ckpt)" << endl;
+    cout << "  --resume            skip tiles already saved in the checkpoint (default: <output_file>.ckpt)" << endl;
+    cout << "  --mmap              render a .bmp output straight into the memory-mapped file" << endl;
+    cout << "  --preview FILE      with a .tif, .raw or --mmap output, also save a downsampled BMP to FILE" << endl;
+    cout << "  --encode-benchmark  time every output format on the rendered image" << endl;
+    cout << "  --time-budget MS    refine coarse to fine and save the best image after MS milliseconds;" << endl;
+    cout << "                      the quality tier reached goes to <output_file>.json" << endl;
+    cout << "  --tile-order O      order tiles are rendered in: rows, morton or hilbert (default hilbert)" << endl;
+    cout << "  --pixel-order O     order of pixels inside a tile: rows, morton or hilbert (default morton)" << endl;
+    cout << "  --stats             print timing, ray counts and throughput after rendering" << endl;
+    cout << "  --trace FILE        save a timeline of load, acceleration build, tiles per thread and encoding to" << endl;
+    cout << "                      FILE in Chrome trace format (open in chrome://tracing or ui.perfetto.dev)" << endl;
+    cout << "  --perf              with --stats, add hardware counters (cycles, IPC, cache and branch misses)" << endl;
+    cout << "                      per phase, per ray and per tile; Linux perf_event_open, skipped if not permitted" << endl;
+    cout << "  --accel A           acceleration structure: none, bvh4 or qbvh4 (8-bit quantized, default)" << endl;
+    cout << "  --accel-build M     how the acceleration structure is split: sah (default) or lbvh (faster build)" << endl;
+    cout << "  --heatmaps          also write <output>.nodes/.tests/.shadow/.depth.bmp: per-pixel node visits," << endl;
+    cout << "                      intersection tests, shadow rays and reflection depth (not for streamed outputs)" << endl;
+    cout << "  --reorder           sort objects by the Morton code of their centers instead of file order" << endl;
+    cout << "  --no-frustum-cull   search every primary ray in the whole scene instead of only the objects" << endl;
+    cout << "                      culled against its tile's frustum" << endl;
 }
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        cout << "Usage: " << argv[0] << " <scene_file> [output_file]" << endl;
-        cout << "Example: " << argv[0] << " scene.txt output.bmp" << endl;
+    vector<string> positional;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--light-samples" && i + 1 < argc) {
+            lightSampleCount = atoi(argv[++i]);
+        } else if (arg == "--light-cull" && i + 1 < argc) {
+            lightCullThreshold = atof(argv[++i]);
+        } else if (arg == "--hybrid") {
+            hybridRender = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            renderThreads = atoi(argv[++i]);
+            if (renderThreads <= 0) renderThreads = max(1u, thread::hardware_concurrency());
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpointFile = argv[++i];
+        } else if (arg == "--resume") {
+            resumeRender = true;
+        } else if (arg == "--mmap") {
+            mappedOutput = true;
+        } else if (arg == "--preview" && i + 1 < argc) {
+            previewFile = argv[++i];
+        } else if (arg == "--encode-benchmark") {
+            encoderBenchmark = true;
+        } else if (arg == "--time-budget" && i + 1 < argc) {
+            timeBudgetMs = atof(argv[++i]);
+        } else if ((arg == "--tile-order" || arg == "--pixel-order") && i + 1 < argc) {
+            if (!parseTraversalOrder(argv[++i], arg == "--tile-order" ? tileOrder : pixelOrder)) {
+                cout << "Unknown order for " << arg << ": " << argv[i] << endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--stats") {
+            printStats = true;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            traceFile = argv[++i];
+        } else if (arg == "--heatmaps") {
+            writeHeatmaps = true;
+        } else if (arg == "--perf") {
+            perfCountersEnabled = true;
+        } else if (arg == "--accel" && i + 1 < argc) {
+            if (!parseAccelLayout(argv[++i], accelLayout)) {
+                cout << "Unknown acceleration structure: " << argv[i] << endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--accel-build" && i + 1 < argc) {
+            if (!parseBuildMethod(argv[++i], accelBuild)) {
+                cout << "Unknown build method: " << argv[i] << endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--reorder") {
+            reorderObjects = true;
+        } else if (arg == "--no-frustum-cull") {
+            frustumCulling = false;
+        } else if (arg.rfind("--", 0) == 0) {
+            cout << "Unknown option: " << arg << endl;
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    
+    if (positional.empty()) {
+        printUsage(argv[0]);
         return 1;
     }
     
-    sceneFile = argv[1];
+    sceneFile = positional[0];
     string outputFile = "";
     
-    if (argc > 2) {
-        outputFile = argv[2];
+    if (positional.size() > 1) {
+        outputFile = positional[1];
     }
     
+    // Opened before any thread starts, so build and tile workers are counted too
+    if (perfCountersEnabled) processCounters.open(true);
+    if (!traceFile.empty()) startTrace();
+
+    accelBuildThreads = renderThreads;
     cout << "Loading scene: " << sceneFile << endl;
-    loadData();
+    auto loadStart = chrono::steady_clock::now();
+    PerfReading hardwareBefore = processCounters.read();
+    {
+        TraceScope span("scene load", "load");
+        loadData();
+    }
+    loadHardware = processCounters.read() - hardwareBefore;
+    renderStats.loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - loadStart).count();
     
     cout << "Starting ray tracing..." << endl;
-    capture(outputFile);
+    hardwareBefore = processCounters.read();
+    bool saved = capture(outputFile);
+    frameHardware = processCounters.read() - hardwareBefore;
+    if (!traceFile.empty()) {
+        if (writeTrace(traceFile)) cout << "Trace saved as " << traceFile << endl;
+        else cout << "Cannot write " << traceFile << endl;
+    }
+    if (printStats) reportStats();
     
     // Clean up
-    for (auto obj : objects) {
-        delete obj;
-    }
+    clearScene();
     
-    return 0;
+    return saved ? 0 : 1;
 }
@@ -0,0 +1,225 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <vector>
+#include <cstdio>
+#include "bitmap_image.hpp"
+using namespace std;
+
+// Linux stand-in for test_scenes.bat: renders every scene of the corpus with raytracer_headless,
+// compares each image to its golden reference by PSNR and each render time to the golden
+// timing, and fails when either regresses past its threshold.
+
+struct RegressionOptions {
+    string corpus = "test_scenes";
+    string golden = "";             // default <corpus>/golden
+    string output = "test_results";
+    string headless = "./raytracer_headless";
+    string renderArgs = "";
+    double minPsnr = 40;            // dB; identical images score 1000000
+    double maxSlowdown = 25;        // percent over the golden render time
+    int runs = 3;                   // render time is the best of this many runs
+    bool update = false;            // store the renders and timings as the new golden set
+};
+
+// Outcome for one scene
+struct SceneResult {
+    string name;
+    string status;                  // pass, FAIL, new or error
+    string reason;
+    double psnr = -1;               // -1 without a golden image
+    double renderMs = -1;
+    double goldenMs = -1;
+};
+
+// Render scene to image with the headless renderer and return its render time, or -1
+double renderScene(const RegressionOptions& options, const string& scene, const string& image) {
+    string command = "\"" + options.headless + "\" \"" + scene + "\" \"" + image + "\" --stats " + options.renderArgs
+                     + " 2>&1";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) return -1;
+    double renderMs = -1;
+    char line[512];
+    while (fgets(line, sizeof(line), pipe)) sscanf(line, " render %lf ms", &renderMs);
+    return pclose(pipe) == 0 ? renderMs : -1;
+}
+
+// Golden render times: one "scene_name milliseconds" line per scene
+map<string, double> loadTimings(const string& path) {
+    map<string, double> timings;
+    ifstream file(path);
+    string name;
+    double ms;
+    while (file >> name >> ms) timings[name] = ms;
+    return timings;
+}
+
+void saveTimings(const map<string, double>& timings, const string& path) {
+    ofstream file(path);
+    for (const auto& entry : timings) file << entry.first << " " << entry.second << endl;
+}
+
+SceneResult checkScene(const RegressionOptions& options, const string& scene, const map<string, double>& timings) {
+    SceneResult result;
+    result.name = filesystem::path(scene).stem().string();
+    string rendered = options.output + "/" + result.name + ".bmp";
+    string reference = options.golden + "/" + result.name + ".bmp";
+
+    for (int run = 0; run < options.runs; run++) {
+        double ms = renderScene(options, scene, rendered);
+        if (ms < 0) {
+            result.status = "error";
+            result.reason = "render failed";
+            return result;
+        }
+        result.renderMs = run == 0 ? ms : min(result.renderMs, ms);
+    }
+
+    bitmap_image image(rendered);
+    if (!image) {
+        result.status = "error";
+        result.reason = "cannot read " + rendered;
+        return result;
+    }
+    if (options.update) {
+        image.save_image(reference);
+        result.status = "new";
+        result.reason = "golden image updated";
+        return result;
+    }
+
+    auto timing = timings.find(result.name);
+    if (timing != timings.end()) result.goldenMs = timing->second;
+    if (!filesystem::exists(reference)) {
+        result.status = "new";
+        result.reason = "no golden image; run with --update to add it";
+        return result;
+    }
+    bitmap_image golden(reference);
+    if (!golden) {
+        result.status = "error";
+        result.reason = "cannot read " + reference;
+        return result;
+    }
+
+    result.psnr = image.psnr(golden);
+    result.status = "pass";
+    vector<string> failures;
+    if (golden.width() != image.width() || golden.height() != image.height()) {
+        failures.push_back("size differs from golden");
+    } else if (result.psnr < options.minPsnr) {
+        failures.push_back("PSNR below " + to_string((int)options.minPsnr) + " dB");
+    }
+    if (result.goldenMs > 0 && result.renderMs > result.goldenMs * (1 + options.maxSlowdown / 100)) {
+        failures.push_back("render time over golden + " + to_string((int)options.maxSlowdown) + "%");
+    }
+    if (!failures.empty()) {
+        result.status = "FAIL";
+        for (size_t k = 0; k < failures.size(); k++) result.reason += (k ? "; " : "") + failures[k];
+    }
+    return result;
+}
+
+// One line per scene, to the console and to the report file
+void writeReport(const vector<SceneResult>& results, ostream& out) {
+    char line[512];
+    snprintf(line, sizeof(line), "%-32s %-6s %10s %11s %11s %8s  %s", "scene", "status", "PSNR (dB)", "render (ms)",
+             "golden (ms)", "change", "notes");
+    out << line << endl;
+    auto format = [](const char* pattern, double value) {
+        char text[32];
+        snprintf(text, sizeof(text), pattern, value);
+        return string(text);
+    };
+    for (const SceneResult& result : results) {
+        string psnr = result.psnr < 0 ? "-" : (result.psnr >= 1000000 ? "identical" : format("%.2f", result.psnr));
+        string renderMs = result.renderMs < 0 ? "-" : format("%.1f", result.renderMs);
+        string goldenMs = result.goldenMs < 0 ? "-" : format("%.1f", result.goldenMs);
+        string change = "-";
+        if (result.goldenMs > 0 && result.renderMs >= 0) change = format("%+.1f%%", (result.renderMs / result.goldenMs - 1) * 100);
+        snprintf(line, sizeof(line), "%-32s %-6s %10s %11s %11s %8s  %s", result.name.c_str(), result.status.c_str(),
+                 psnr.c_str(), renderMs.c_str(), goldenMs.c_str(), change.c_str(), result.reason.c_str());
+        out << line << endl;
+    }
+}
+
+void printUsage(const char* program) {
+    cout << "Usage: " << program << " [scene_files...] [options]" << endl;
+    cout << "Renders each scene (default: every .txt in test_scenes) and compares it to the golden set" << endl;
+    cout << "Exits with 1 if any scene fails or cannot be rendered" << endl;
+    cout << "Options:" << endl;
+    cout << "  --corpus DIR        directory of scene files (default test_scenes)" << endl;
+    cout << "  --golden DIR        golden images <scene>.bmp and timings.txt (default <corpus>/golden)" << endl;
+    cout << "  --output DIR        renders and report.txt go here (default test_results)" << endl;
+    cout << "  --min-psnr DB       fail below this PSNR against the golden image (default 40)" << endl;
+    cout << "  --max-slowdown PCT  fail when rendering takes PCT percent longer than the golden time (default 25)" << endl;
+    cout << "  --runs N            render time is the best of N renders (default 3)" << endl;
+    cout << "  --headless PATH     renderer to test (default ./raytracer_headless)" << endl;
+    cout << "  --render-args ARGS  extra options passed to the renderer, e.g. \"--threads 4\"" << endl;
+    cout << "  --update            save the renders and their times as the new golden set" << endl;
+    cout << "Golden timings are only meaningful on the machine that recorded them." << endl;
+}
+
+int main(int argc, char** argv) {
+    RegressionOptions options;
+    vector<string> scenes;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--corpus" && hasValue) options.corpus = argv[++i];
+        else if (arg == "--golden" && hasValue) options.golden = argv[++i];
+        else if (arg == "--output" && hasValue) options.output = argv[++i];
+        else if (arg == "--min-psnr" && hasValue) options.minPsnr = atof(argv[++i]);
+        else if (arg == "--max-slowdown" && hasValue) options.maxSlowdown = atof(argv[++i]);
+        else if (arg == "--runs" && hasValue) options.runs = max(1, atoi(argv[++i]));
+        else if (arg == "--headless" && hasValue) options.headless = argv[++i];
+        else if (arg == "--render-args" && hasValue) options.renderArgs = argv[++i];
+        else if (arg == "--update") options.update = true;
+        else if (arg.rfind("--", 0) == 0) {
+            cout << "Unknown option: " << arg << endl;
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            scenes.push_back(arg);
+        }
+    }
+    if (options.golden.empty()) options.golden = options.corpus + "/golden";
+
+    if (scenes.empty()) {
+        error_code error;
+        for (const auto& entry : filesystem::directory_iterator(options.corpus, error)) {
+            if (entry.path().extension() == ".txt") scenes.push_back(entry.path().string());
+        }
+        sort(scenes.begin(), scenes.end());
+    }
+    if (scenes.empty()) {
+        cout << "No scene files to test (looked in " << options.corpus << ")" << endl;
+        return 1;
+    }
+    filesystem::create_directories(options.output);
+    if (options.update) filesystem::create_directories(options.golden);
+
+    string timingsPath = options.golden + "/timings.txt";
+    map<string, double> timings = loadTimings(timingsPath);
+    vector<SceneResult> results;
+    int failed = 0;
+    for (size_t k = 0; k < scenes.size(); k++) {
+        cout << "[" << k + 1 << "/" << scenes.size() << "] " << scenes[k] << "... " << flush;
+        SceneResult result = checkScene(options, scenes[k], timings);
+        cout << result.status << (result.reason.empty() ? "" : " (" + result.reason + ")") << endl;
+        if (result.status == "FAIL" || result.status == "error") failed++;
+        if (options.update && result.renderMs >= 0) timings[result.name] = result.renderMs;
+        results.push_back(result);
+    }
+    if (options.update) saveTimings(timings, timingsPath);
+
+    cout << endl;
+    writeReport(results, cout);
+    ofstream report(options.output + "/report.txt");
+    writeReport(results, report);
+    cout << endl << scenes.size() - failed << " of " << scenes.size() << " scenes passed; report in "
+         << options.output << "/report.txt" << endl;
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,30 @@
+#include "render_stats.h"
+
+thread_local RayCounters rayCounters;
+
+TileStart tileStart() {
+    return TileStart{rayCounters, readThreadCounters()};
+}
+
+void RenderStats::addTile(int tilePixels, const TileStart& start) {
+    PerfReading tileHardwareUsed;
+    if (perfCountersEnabled) tileHardwareUsed = readThreadCounters() - start.hardware;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    tiles++;
+    pixels += tilePixels;
+    rays.nearest += rayCounters.nearest - start.rays.nearest;
+    rays.shadow += rayCounters.shadow - start.rays.shadow;
+    rays.nodeVisits += rayCounters.nodeVisits - start.rays.nodeVisits;
+    rays.primitiveTests += rayCounters.primitiveTests - start.rays.primitiveTests;
+    if (perfCountersEnabled) {
+        hardware += tileHardwareUsed;
+        tileHardware.push_back(tileHardwareUsed);
+    }
+}
+
+void RenderStats::addCulledTile(bool empty) {
+    std::lock_guard<std::mutex> lock(mutex);
+    culledTiles++;
+    if (empty) emptyTiles++;
+}
@@ -0,0 +1,50 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "perf_counters.h"
+
+// Rays cast on this thread so far; cheap enough to count unconditionally
+struct RayCounters {
+    uint64_t nearest = 0;       // closest-hit queries: primary and reflection rays
+    uint64_t shadow = 0;        // any-hit queries towards lights
+    uint64_t nodeVisits = 0;    // acceleration structure nodes whose children were tested
+    uint64_t primitiveTests = 0; // object intersection tests made by closest-hit and shadow queries
+};
+
+extern thread_local RayCounters rayCounters;
+
+// This thread's counters as a tile begins
+struct TileStart {
+    RayCounters rays;
+    PerfReading hardware;       // zeros unless perfCountersEnabled
+};
+
+TileStart tileStart();
+
+// Totals of one or more renders, for the --stats report
+struct RenderStats {
+    double loadSeconds = 0;     // reading the scene file
+    double renderSeconds = 0;   // wall time inside renderImage / renderTiled
+    uint64_t pixels = 0;        // primary rays
+    uint64_t tiles = 0;
+    uint64_t culledTiles = 0;   // tiles whose primary rays only tested the objects in their frustum
+    uint64_t emptyTiles = 0;    // culled tiles with nothing in their frustum
+    RayCounters rays;
+    PerfReading hardware;       // summed over tiles, with perfCountersEnabled
+    std::vector<PerfReading> tileHardware;  // each tile's own, in the order they finished
+
+    // Count a finished tile of 'pixels' pixels and what its worker did since 'start'
+    void addTile(int pixels, const TileStart& start);
+    // Count a tile rendered with frustum culling; empty if no object survived
+    void addCulledTile(bool empty);
+
+    uint64_t totalRays() const { return rays.nearest + rays.shadow; }
+
+private:
+    std::mutex mutex;
+};
+
+#endif // RENDER_STATS_H
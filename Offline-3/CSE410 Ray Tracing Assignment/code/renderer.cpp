@@ -0,0 +1,260 @@
+#include "renderer.h"
+#include "tile_cache.h"
+#include "hybrid.h"
+#include "checkpoint.h"
+#include "render_stats.h"
+#include "heatmap.h"
+#include "trace.h"
+#include "light_tree.h"
+#include "tile_frustum.h"
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+ImagePlane::ImagePlane(const Camera& camera, int width, int height, double jitterX, double jitterY)
+    : eye(camera.eye), right(camera.right), up(camera.up), width(width), height(height) {
+    // Calculate plane distance and setup
+    double planeDistance = (camera.windowHeight / 2.0) / tan((camera.viewAngle * M_PI / 180.0) / 2.0);
+    topleft = camera.eye + camera.look * planeDistance - camera.right * (camera.windowWidth / 2.0)
+              + camera.up * (camera.windowHeight / 2.0);
+
+    du = (double)camera.windowWidth / width;
+    dv = (double)camera.windowHeight / height;
+
+    topleft = topleft + right * ((0.5 + jitterX) * du) - up * ((0.5 + jitterY) * dv);
+}
+
+Ray ImagePlane::primaryRay(int i, int j) const {
+    Vector3D curPixel = topleft + right * (i * du) - up * (j * dv);
+    Vector3D rayDir = (curPixel - eye).normalize();
+    return Ray(eye, rayDir);
+}
+
+bool ImagePlane::project(const Vector3D& point, double& i, double& j, double& depth) const {
+    Vector3D look = up.cross(right);
+    Vector3D toPoint = point - eye;
+    depth = toPoint.dot(look);
+    if (depth <= 1e-9) return false;
+
+    // Where the line from the eye to the point crosses the image plane
+    double scale = (topleft - eye).dot(look) / depth;
+    Vector3D onPlane = eye + toPoint * scale - topleft;
+    i = onPlane.dot(right) / du;
+    j = -onPlane.dot(up) / dv;
+    return true;
+}
+
+static bool sameVector(const Vector3D& a, const Vector3D& b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+bool sameCamera(const Camera& a, const Camera& b) {
+    return sameVector(a.eye, b.eye) && sameVector(a.look, b.look) && sameVector(a.up, b.up)
+           && a.viewAngle == b.viewAngle && a.windowWidth == b.windowWidth && a.windowHeight == b.windowHeight;
+}
+
+void GBuffer::resize(const Camera& cam, int w, int h) {
+    camera = cam;
+    width = w;
+    height = h;
+    objectId.assign(w * h, -1);
+    position.resize(w * h);
+    normal.resize(w * h);
+    baseColor.resize(w * h);
+}
+
+bool GBuffer::matches(const Camera& cam, int w, int h) const {
+    return !objectId.empty() && width == w && height == h && sameCamera(camera, cam);
+}
+
+Vector3D tracePixel(const ImagePlane& plane, int i, int j, GBuffer* gbuffer,
+                    const VisibilityBuffer* visibility, const TileObjects* tileObjects) {
+    Ray ray = plane.primaryRay(i, j);
+    if (activeTileRecord) activeTileRecord->primaryDirections.extend(ray.dir);
+
+    double tMin;
+    int nearest = visibility ? resolveVisibility(*visibility, &ray, i, j, tMin, tileObjects)
+                  : tileObjects ? tileObjects->nearest(&ray, tMin) : findNearestObject(&ray, tMin);
+    if (gbuffer) gbuffer->objectId[j * plane.width + i] = nearest;
+    if (nearest == -1) return Vector3D(0, 0, 0);
+
+    SurfaceHit hit = objects[nearest]->surfaceAt(&ray, tMin);
+    if (gbuffer) {
+        int index = j * plane.width + i;
+        gbuffer->position[index] = hit.point;
+        gbuffer->normal[index] = hit.normal;
+        gbuffer->baseColor[index] = hit.baseColor;
+    }
+
+    double color[3] = {0.0, 0.0, 0.0};
+    objects[nearest]->shadeHit(&ray, hit, color, 1);
+    return Vector3D(color[0], color[1], color[2]);
+}
+
+Vector3D relightPixel(const ImagePlane& plane, int i, int j, const GBuffer& gbuffer) {
+    int index = j * plane.width + i;
+    int id = gbuffer.objectId[index];
+    if (id < 0 || id >= (int)objects.size()) return Vector3D(0, 0, 0);
+
+    // The ray is regenerated from the camera; only its direction is used for shading
+    Ray ray = plane.primaryRay(i, j);
+    SurfaceHit hit;
+    hit.point = gbuffer.position[index];
+    hit.normal = gbuffer.normal[index];
+    hit.baseColor = gbuffer.baseColor[index];
+
+    double color[3] = {0.0, 0.0, 0.0};
+    objects[id]->shadeHit(&ray, hit, color, 1);
+    return Vector3D(color[0], color[1], color[2]);
+}
+
+void writePixel(bitmap_image& image, int i, int j, const Vector3D& color) {
+    // Clamp colors to [0,1] and convert to [0,255]
+    int r = (int)(clamp(color.x, 0.0, 1.0) * 255);
+    int g = (int)(clamp(color.y, 0.0, 1.0) * 255);
+    int b = (int)(clamp(color.z, 0.0, 1.0) * 255);
+    image.set_pixel(i, j, r, g, b);
+}
+
+bool forEachTile(int numTiles, int threads, const std::function<bool(int)>& work) {
+    std::atomic<int> nextTile(0), finishedTiles(0);
+    std::atomic<bool> stopped(false);
+    std::mutex progressMutex;
+    int lastPercent = -1;
+
+    // Each worker takes the next tile until none are left
+    auto worker = [&]() {
+        for (int tile = nextTile++; tile < numTiles && !stopped; tile = nextTile++) {
+            if (!work(tile)) {
+                stopped = true;
+                break;
+            }
+
+            // Progress indicator
+            int percent = finishedTiles++ * 100 / numTiles;
+            std::lock_guard<std::mutex> lock(progressMutex);
+            if (percent / 5 > lastPercent / 5) {
+                showProgress(percent);
+                lastPercent = percent;
+            }
+        }
+    };
+
+    threads = std::max(1, std::min(threads, numTiles));
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++) workers.emplace_back(worker);
+    worker();
+    for (std::thread& t : workers) t.join();
+
+    // Ensure 100% is shown at completion
+    if (!stopped) showProgress(100);
+    return !stopped;
+}
+
+bool renderImage(const Camera& camera, bitmap_image& image, const RenderOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    int width = image.width(), height = image.height();
+    ImagePlane plane(camera, width, height, options.jitterX, options.jitterY);
+
+    GBuffer* gbuffer = options.gbuffer;
+    TileCache* tileCache = options.tileCache;
+    bool relight = options.relight && gbuffer && gbuffer->matches(camera, width, height);
+
+    // Incremental renders need records (and hits, if kept) for this exact view
+    bool incremental = options.incremental && !relight && tileCache && tileCache->matches(camera, width, height)
+                       && (!gbuffer || gbuffer->matches(camera, width, height));
+    if (gbuffer && !relight && !incremental) gbuffer->resize(camera, width, height);
+    if (tileCache && !incremental && !relight) tileCache->resize(camera, width, height);
+
+    // Primary visibility for the whole frame up front; tiles then only shade
+    VisibilityBuffer visibility;
+    bool hybrid = options.hybrid && !relight;
+    if (hybrid) {
+        TraceScope span("rasterize visibility", "render");
+        rasterizeVisibility(plane, visibility);
+    }
+
+    int tileSize = TileCache::TILE_SIZE;
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+    std::vector<int> tileOrder = tileSequence(tilesX, tilesY, options.tileOrder);
+    Checkpoint* checkpoint = options.checkpoint;
+    RenderStats* stats = options.stats;
+    CostMaps* costMaps = options.costMaps;
+    if (costMaps && (costMaps->width != width || costMaps->height != height)) costMaps->resize(width, height);
+    std::vector<Vector3D>* accumulation = options.accumulation;
+    double sampleWeight = 1.0 / (options.accumulatedSamples + 1);
+    auto pastDeadline = [&options]() {
+        return options.deadline && std::chrono::steady_clock::now() >= *options.deadline;
+    };
+
+    // Render one tile; false once the deadline cuts it off
+    auto renderTile = [&](int step) {
+        int tile = tileOrder[step];
+        int tx = tile % tilesX, ty = tile / tilesX;
+        if ((incremental && !tileCache->dirty[tile]) || (checkpoint && checkpoint->isDone(tile))) return true;
+        TraceScope span("tile", "render", "tile", tile);
+
+        // Only full renders and incremental re-renders rebuild the tile records
+        TileRecord* record = (tileCache && !relight) ? &tileCache->tiles[tile] : nullptr;
+        if (record) record->clear();
+        activeTileRecord = record;
+        TileStart started = tileStart();
+
+        int x0 = tx * tileSize, y0 = ty * tileSize;
+        int tileWidth = std::min(width, x0 + tileSize) - x0, tileHeight = std::min(height, y0 + tileSize) - y0;
+        static thread_local std::vector<Vector3D> colors;
+        colors.resize(tileWidth * tileHeight);
+
+        // Primary rays of sky and plain floor tiles then test next to nothing. Hybrid renders
+        // only look for the objects the rasterizer left to rays.
+        static thread_local TileObjects tileObjects;
+        bool culled = options.frustumCulling && !relight
+                      && tileObjects.gather(TileFrustum(plane, x0, y0, x0 + tileWidth, y0 + tileHeight),
+                                            hybrid ? &visibility.isRayTested : nullptr);
+        const std::vector<int>& pixels = pixelSequence(tileSize, options.pixelOrder);
+        bool cut = false;
+        for (int n = 0; n < (int)pixels.size(); n++) {
+            // Checked once per tile row's worth of pixels; a cut-off tile keeps its old pixels
+            if (n % tileSize == 0 && pastDeadline()) {
+                cut = true;
+                break;
+            }
+            int dx = pixels[n] % tileSize, dy = pixels[n] / tileSize;
+            if (dx >= tileWidth || dy >= tileHeight) continue;  // past the image edge
+            int i = x0 + dx, j = y0 + dy;
+            RayCounters pixelStart;
+            if (costMaps) pixelStart = rayCounters;
+            seedLightSampling(i, j, options.accumulatedSamples);
+            Vector3D color = relight ? relightPixel(plane, i, j, *gbuffer)
+                                     : tracePixel(plane, i, j, gbuffer, hybrid ? &visibility : nullptr,
+                                                  culled ? &tileObjects : nullptr);
+            if (costMaps) costMaps->record(i, j, pixelStart);
+            if (accumulation) {
+                Vector3D& sum = (*accumulation)[j * width + i];
+                sum = sum + color;
+                color = sum * sampleWeight;
+            }
+            writePixel(image, i, j, color);
+            colors[dy * tileWidth + dx] = color;
+        }
+
+        activeTileRecord = nullptr;
+        if (cut) return false;
+        if (record) {
+            record->finish();
+            tileCache->dirty[tile] = 0;
+        }
+        if (checkpoint) checkpoint->tileFinished(tile, colors, 1);
+        if (stats) stats->addTile(tileWidth * tileHeight, started);
+        if (stats && culled) stats->addCulledTile(tileObjects.indices.empty());
+        return true;
+    };
+    bool finished = forEachTile((int)tileOrder.size(), options.threads, renderTile);
+
+    if (checkpoint) checkpoint->flush();
+    if (stats) stats->renderSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return finished;
+}
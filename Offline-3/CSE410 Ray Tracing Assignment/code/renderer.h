@@ -0,0 +1,101 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <vector>
+#include <chrono>
+#include <functional>
+#include "2005062_classes.h"
+#include "traversal.h"
+
+// Camera state used to generate primary rays
+struct Camera {
+    Vector3D eye, look, up, right;
+    double viewAngle;
+    int windowWidth, windowHeight;
+};
+
+bool sameCamera(const Camera& a, const Camera& b);
+
+// Pixel grid on the image plane for one camera and image size
+struct ImagePlane {
+    Vector3D eye, topleft, right, up;
+    double du, dv;
+    int width, height;
+
+    // jitterX/jitterY shift every pixel's sample point by that fraction of a pixel
+    ImagePlane(const Camera& camera, int width, int height, double jitterX = 0, double jitterY = 0);
+
+    // Primary ray through the center of pixel (i, j); i is the column, j the row from the top
+    Ray primaryRay(int i, int j) const;
+
+    // Inverse of primaryRay: continuous pixel coordinates of a world point and its depth along
+    // the view direction. False if the point is behind the camera.
+    bool project(const Vector3D& point, double& i, double& j, double& depth) const;
+};
+
+// Primary hits of the last render: object id, position, normal and base color per pixel
+struct GBuffer {
+    Camera camera;
+    int width = 0, height = 0;
+    std::vector<int> objectId;      // index into objects, -1 where the primary ray hit nothing
+    std::vector<Vector3D> position, normal, baseColor;
+
+    void resize(const Camera& camera, int width, int height);
+    void clear() { objectId.clear(); width = height = 0; }
+    // True if the buffer holds hits for this exact view
+    bool matches(const Camera& camera, int width, int height) const;
+};
+
+struct VisibilityBuffer;
+struct TileObjects;
+
+// Trace the primary ray of pixel (i, j) and shade it; records the hit in gbuffer when given.
+// With a visibility buffer the primary hit comes from rasterization instead of a full ray cast.
+// tileObjects holds the objects culled for the pixel's tile (only the ray-tested ones with a
+// visibility buffer); the primary ray is then only tested against those.
+Vector3D tracePixel(const ImagePlane& plane, int i, int j, GBuffer* gbuffer,
+                    const VisibilityBuffer* visibility = nullptr, const TileObjects* tileObjects = nullptr);
+
+// Re-shade pixel (i, j) from the G-buffer, tracing only shadow and reflection rays
+Vector3D relightPixel(const ImagePlane& plane, int i, int j, const GBuffer& gbuffer);
+
+class TileCache;
+class Checkpoint;
+struct RenderStats;
+struct CostMaps;
+
+// Optional features of a render
+struct RenderOptions {
+    GBuffer* gbuffer = nullptr;     // primary hits are recorded here (or read back when relighting)
+    bool relight = false;           // re-shade from gbuffer; falls back to a full render if it doesn't match
+    TileCache* tileCache = nullptr; // per-tile records of touched objects are kept here
+    bool incremental = false;       // only re-render tiles marked dirty in tileCache, keep the rest of image
+    bool hybrid = false;            // rasterize primary visibility, ray trace only shadows and reflections
+    Checkpoint* checkpoint = nullptr; // finished tiles are saved here; tiles it already has are skipped
+    int threads = 1;                // tile workers rendering in parallel
+    double jitterX = 0, jitterY = 0; // sub-pixel offset of the primary rays, in pixels
+    std::vector<Vector3D>* accumulation = nullptr; // running color sums; pixels are written as the mean
+    int accumulatedSamples = 0;     // samples already in accumulation
+    const std::chrono::steady_clock::time_point* deadline = nullptr; // stop starting work after this
+    TraversalOrder tileOrder = ORDER_HILBERT;   // order tiles are handed out in
+    TraversalOrder pixelOrder = ORDER_MORTON;   // order of the pixels inside a tile
+    RenderStats* stats = nullptr;   // timing and ray counts are added here
+    CostMaps* costMaps = nullptr;   // resized to the image and filled with each pixel's ray costs
+    bool frustumCulling = true;     // cull objects against each tile's frustum before casting its primary rays
+};
+
+// Render the image tile by tile, tiles handed out to options.threads workers.
+// Returns false if the deadline stopped it before every pixel was rendered.
+bool renderImage(const Camera& camera, bitmap_image& image, const RenderOptions& options);
+
+// Run work(tile) for tiles 0..numTiles-1 on 'threads' workers, showing progress. Stops handing
+// out tiles once work returns false; returns false in that case.
+bool forEachTile(int numTiles, int threads, const std::function<bool(int)>& work);
+
+// Store a shaded color in the image, clamped to [0, 1]
+void writePixel(bitmap_image& image, int i, int j, const Vector3D& color);
+
+// Defined by each executable
+void showProgress(int percentage);
+
+#endif // RENDERER_H
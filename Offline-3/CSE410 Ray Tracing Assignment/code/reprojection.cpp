@@ -0,0 +1,52 @@
+#include "reprojection.h"
+#include <cmath>
+#include <limits>
+
+void reprojectFrame(const GBuffer& oldHits, const bitmap_image& oldImage, const Camera& newCamera,
+                    GBuffer& newHits, bitmap_image& newImage, std::vector<char>& reprojected) {
+    int width = newImage.width(), height = newImage.height();
+    ImagePlane plane(newCamera, width, height);
+
+    newHits.resize(newCamera, width, height);
+    newImage.set_all_channels(0, 0, 0);
+    reprojected.assign(width * height, 0);
+    std::vector<double> depth(width * height, std::numeric_limits<double>::infinity());
+
+    for (int j = 0; j < oldHits.height; j++) {
+        for (int i = 0; i < oldHits.width; i++) {
+            int from = j * oldHits.width + i;
+            if (oldHits.objectId[from] < 0) continue;
+
+            double pi, pj, d;
+            if (!plane.project(oldHits.position[from], pi, pj, d)) continue;
+            int x = (int)floor(pi + 0.5), y = (int)floor(pj + 0.5);
+            if (x < 0 || y < 0 || x >= width || y >= height) continue;
+
+            // Keep the closest surface landing on each pixel
+            int to = y * width + x;
+            if (d >= depth[to]) continue;
+            depth[to] = d;
+
+            unsigned char r, g, b;
+            oldImage.get_pixel(i, j, r, g, b);
+            newImage.set_pixel(x, y, r, g, b);
+            newHits.objectId[to] = oldHits.objectId[from];
+            newHits.position[to] = oldHits.position[from];
+            newHits.normal[to] = oldHits.normal[from];
+            newHits.baseColor[to] = oldHits.baseColor[from];
+            reprojected[to] = 1;
+        }
+    }
+}
+
+void refinementOrder(const std::vector<char>& reprojected, std::vector<int>& order, int& unsampledCount) {
+    order.clear();
+    order.reserve(reprojected.size());
+    for (int p = 0; p < (int)reprojected.size(); p++) {
+        if (!reprojected[p]) order.push_back(p);
+    }
+    unsampledCount = order.size();
+    for (int p = 0; p < (int)reprojected.size(); p++) {
+        if (reprojected[p]) order.push_back(p);
+    }
+}
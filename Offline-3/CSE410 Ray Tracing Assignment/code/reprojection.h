@@ -0,0 +1,18 @@
+#ifndef REPROJECTION_H
+#define REPROJECTION_H
+
+#include <vector>
+#include "renderer.h"
+
+// Warp a rendered frame into a new camera using the hit positions in its G-buffer.
+// Each old hit is splatted to the nearest new pixel with a depth test. Pixels that got
+// a sample are flagged in 'reprojected' and take over the old hit in newHits; the rest
+// (disocclusions, background, cracks from magnification) are left black for tracing.
+void reprojectFrame(const GBuffer& oldHits, const bitmap_image& oldImage, const Camera& newCamera,
+                    GBuffer& newHits, bitmap_image& newImage, std::vector<char>& reprojected);
+
+// Pixel indices (j * width + i) in refinement order: pixels without a sample first,
+// then reprojected ones, each group in scanline order
+void refinementOrder(const std::vector<char>& reprojected, std::vector<int>& order, int& unsampledCount);
+
+#endif // REPROJECTION_H
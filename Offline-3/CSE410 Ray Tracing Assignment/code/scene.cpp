@@ -0,0 +1,135 @@
+#include "scene.h"
+#include "bvh.h"
+#include <cstdint>
+#include <algorithm>
+
+SceneArena sceneArena;
+bool reorderObjects = false;
+std::vector<int> objectFileIndex;
+
+void* SceneArena::allocate(size_t size, size_t align) {
+    // Fill the current block, then move on to the next kept block (or a new one) that fits
+    while (current < blocks.size()) {
+        size_t start = (offset + align - 1) / align * align;
+        if (start + size <= blocks[current].size) {
+            offset = start + size;
+            used += size;
+            return blocks[current].data.get() + start;
+        }
+        current++;
+        offset = 0;
+    }
+    size_t blockSize = std::max(BLOCK_SIZE, size + align);
+    blocks.push_back(Block{std::unique_ptr<char[]>(new char[blockSize]), blockSize});
+    return allocate(size, align);
+}
+
+void SceneArena::runDestructors() {
+    for (auto it = destructors.rbegin(); it != destructors.rend(); ++it) it->destroy(it->object);
+    destructors.clear();
+}
+
+void SceneArena::reset() {
+    runDestructors();
+    current = offset = used = 0;
+}
+
+void SceneArena::release() {
+    reset();
+    blocks.clear();
+}
+
+void SceneArena::swap(SceneArena& other) {
+    std::swap(blocks, other.blocks);
+    std::swap(current, other.current);
+    std::swap(offset, other.offset);
+    std::swap(used, other.used);
+    std::swap(destructors, other.destructors);
+}
+
+size_t SceneArena::bytesReserved() const {
+    size_t total = 0;
+    for (const Block& block : blocks) total += block.size;
+    return total;
+}
+
+void clearScene() {
+    sceneBVH.clear();
+    objects.clear();
+    pointLights.clear();
+    spotLights.clear();
+    objectFileIndex.clear();
+    sceneArena.reset();
+}
+
+static bool isRelocatable(Object* object) {
+    return dynamic_cast<Sphere*>(object) || dynamic_cast<Triangle*>(object) || dynamic_cast<GeneralQuadric*>(object)
+           || dynamic_cast<Floor*>(object);
+}
+
+// Copy of object placed in arena; the original gives up what it owns
+static Object* relocate(SceneArena& arena, Object* object) {
+    if (Sphere* sphere = dynamic_cast<Sphere*>(object)) return arena.make<Sphere>(*sphere);
+    if (Triangle* triangle = dynamic_cast<Triangle*>(object)) return arena.make<Triangle>(*triangle);
+    if (GeneralQuadric* quad = dynamic_cast<GeneralQuadric*>(object)) return arena.make<GeneralQuadric>(*quad);
+    if (Floor* floor = dynamic_cast<Floor*>(object)) {
+        Floor* copy = arena.make<Floor>(*floor);
+        floor->textureData = nullptr;
+        return copy;
+    }
+    return object;
+}
+
+// Spread the low 21 bits of v three bits apart
+static uint64_t spreadBits3(uint64_t v) {
+    v &= 0x1FFFFF;
+    v = (v | (v << 32)) & 0x001F00000000FFFFULL;
+    v = (v | (v << 16)) & 0x001F0000FF0000FFULL;
+    v = (v | (v << 8)) & 0x100F00F00F00F00FULL;
+    v = (v | (v << 4)) & 0x10C30C30C30C30C3ULL;
+    v = (v | (v << 2)) & 0x1249249249249249ULL;
+    return v;
+}
+
+uint64_t mortonKey(const Vector3D& point, const Bounds& box) {
+    Vector3D offset = point - box.min, extent = box.max - box.min;
+    auto cell = [](double at, double size) {
+        return size > 0 ? (uint64_t)std::max(0.0, std::min(2097151.0, at / size * 2097152.0)) : 0;
+    };
+    return spreadBits3(cell(offset.x, extent.x)) | (spreadBits3(cell(offset.y, extent.y)) << 1)
+           | (spreadBits3(cell(offset.z, extent.z)) << 2);
+}
+
+void finalizeScene() {
+    int count = objects.size();
+    std::vector<Bounds> bounds(count);
+    Bounds sceneBounds;
+    for (int k = 0; k < count; k++) {
+        bounds[k] = objects[k]->getBounds();
+        if (bounds[k].isFinite()) sceneBounds.extend(bounds[k].center());
+    }
+
+    // Key of each bounded object's center within the box of all centers
+    const uint64_t UNBOUNDED = ~0ULL;
+    std::vector<uint64_t> key(count, UNBOUNDED);
+    for (int k = 0; k < count && reorderObjects; k++) {
+        if (bounds[k].isFinite()) key[k] = mortonKey(bounds[k].center(), sceneBounds);
+    }
+
+    // Stable, so equal keys (and the unbounded objects) keep file order
+    objectFileIndex.resize(count);
+    for (int k = 0; k < count; k++) objectFileIndex[k] = k;
+    std::stable_sort(objectFileIndex.begin(), objectFileIndex.end(), [&key](int a, int b) { return key[a] < key[b]; });
+
+    std::vector<Object*> sorted(count);
+    for (int k = 0; k < count; k++) sorted[k] = objects[objectFileIndex[k]];
+    objects.swap(sorted);
+
+    // Lay the objects out in memory in the same order, so neighbors share cache lines too
+    if (reorderObjects && std::all_of(objects.begin(), objects.end(), isRelocatable)) {
+        SceneArena packed;
+        for (int k = 0; k < count; k++) objects[k] = relocate(packed, objects[k]);
+        sceneArena.swap(packed);
+    }
+    buildAccel();
+}
@@ -0,0 +1,83 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "2005062_classes.h"
+
+// Types whose destructor frees something (the floor's texture). The arena runs only these
+// destructors; every other object is simply dropped with its block.
+template <class T> struct OwnsResources : std::false_type {};
+template <> struct OwnsResources<Floor> : std::true_type {};
+
+// Monotonic allocator owning the objects of the scene. Objects are placed one after another in
+// large blocks, so loading does no per-object heap allocation and objects created together share
+// cache lines. reset() drops everything at once and keeps the blocks for the next scene.
+class SceneArena {
+public:
+    SceneArena() = default;
+    SceneArena(const SceneArena&) = delete;
+    SceneArena& operator=(const SceneArena&) = delete;
+    ~SceneArena() { release(); }
+
+    template <class T, class... Args>
+    T* make(Args&&... args) {
+        T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (OwnsResources<T>::value) destructors.push_back({object, [](void* p) { static_cast<T*>(p)->~T(); }});
+        return object;
+    }
+
+    // Destroy every object; the blocks are kept and refilled from the start
+    void reset();
+    // Destroy every object and free the blocks
+    void release();
+    void swap(SceneArena& other);
+
+    size_t bytesUsed() const { return used; }
+    size_t bytesReserved() const;
+    int blockCount() const { return blocks.size(); }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    struct Destructor {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    static const size_t BLOCK_SIZE = 256 * 1024;
+
+    void* allocate(size_t size, size_t align);
+    void runDestructors();
+
+    std::vector<Block> blocks;
+    size_t current = 0, offset = 0;     // block being filled and the bytes used in it
+    size_t used = 0;
+    std::vector<Destructor> destructors;
+};
+
+extern SceneArena sceneArena;           // owns every entry of objects
+
+extern bool reorderObjects;             // sort objects by Morton code in finalizeScene
+extern std::vector<int> objectFileIndex; // position in the scene file of each entry of objects
+
+// 63-bit Morton code of a point's position inside box (21 bits per axis)
+uint64_t mortonKey(const Vector3D& point, const Bounds& box);
+
+// Remove all objects and lights. Costs the same however many primitives the scene has.
+void clearScene();
+
+// Run once the scene file has been read, before anything indexes objects. With reorderObjects,
+// bounded objects are put in Morton order of their bounds' centers (so neighbors in space are
+// neighbors in the list and in memory) and unbounded ones after them in file order.
+// Fills objectFileIndex and builds the acceleration structure.
+void finalizeScene();
+
+#endif // SCENE_H
@@ -0,0 +1,321 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// Writes random scenes in the scene file format the renderers read, for benchmarks that sweep
+// object and light counts. The same seed and options always produce the same file.
+
+// Where object centers go
+enum Layout {
+    LAYOUT_UNIFORM,     // anywhere in the box above the floor
+    LAYOUT_CLUSTERED,   // gaussian blobs around a few random centers
+    LAYOUT_PILE         // a dense conical heap resting on the floor at the origin
+};
+
+struct GeneratorOptions {
+    unsigned seed = 1;
+    int spheres = 0, triangles = 0, meshes = 0, quadrics = 0;
+    int pointLights = 2, spotLights = 0;
+    int meshResolution = 8;     // rings of each mesh sphere; 4 * R * (R - 1) triangles
+    Layout layout = LAYOUT_UNIFORM;
+    int clusters = 8;
+    double extent = 80;         // objects lie within [-extent, extent] in x and y
+    double size = 4;            // typical radius of an object
+    double mirrorFraction = 0.2; // share of objects with a reflection coefficient
+    int recursion = 3;
+    int imageSize = 512;
+};
+
+class SceneGenerator {
+public:
+    SceneGenerator(const GeneratorOptions& options, ostream& out) : options(options), out(out), rng(options.seed) {
+        uniform_real_distribution<double> across(-options.extent, options.extent), height(0, options.extent * 0.6);
+        for (int k = 0; k < options.clusters; k++) {
+            clusterCenters.push_back({across(rng), across(rng), options.size + height(rng)});
+        }
+    }
+
+    void write() {
+        long trianglesPerMesh = 4L * options.meshResolution * (options.meshResolution - 1);
+        long objectCount = options.spheres + options.triangles + options.meshes * trianglesPerMesh + options.quadrics;
+        out << fixed << setprecision(4);
+        out << options.recursion << "\n" << options.imageSize << "\n\n" << objectCount << "\n\n";
+
+        for (int k = 0; k < options.spheres; k++) writeSphere();
+        for (int k = 0; k < options.triangles; k++) writeSoupTriangle();
+        for (int k = 0; k < options.meshes; k++) writeMesh();
+        for (int k = 0; k < options.quadrics; k++) writeQuadric(k % 3);
+
+        writeLights();
+    }
+
+private:
+    struct Point {
+        double x, y, z;
+    };
+
+    double uniform(double lo, double hi) { return uniform_real_distribution<double>(lo, hi)(rng); }
+    double gauss() { return normal_distribution<double>()(rng); }
+
+    // Center for an object of the given radius, never below the floor
+    Point place(double radius) {
+        Point p;
+        switch (options.layout) {
+            case LAYOUT_CLUSTERED: {
+                const Point& center = clusterCenters[uniform_int_distribution<int>(0, options.clusters - 1)(rng)];
+                double sigma = options.extent * 0.06;
+                p = {center.x + gauss() * sigma, center.y + gauss() * sigma, center.z + gauss() * sigma};
+                break;
+            }
+            case LAYOUT_PILE: {
+                double pileRadius = options.extent * 0.4, pileHeight = options.extent * 0.5;
+                double r = pileRadius * sqrt(uniform(0, 1)), angle = uniform(0, 2 * M_PI);
+                p = {r * cos(angle), r * sin(angle), uniform(0, pileHeight * (1 - r / pileRadius))};
+                break;
+            }
+            default:
+                p = {uniform(-options.extent, options.extent), uniform(-options.extent, options.extent),
+                     uniform(0, options.extent)};
+        }
+        p.z = max(p.z, radius);
+        return p;
+    }
+
+    Point randomDirection() {
+        Point d = {gauss(), gauss(), gauss()};
+        double length = sqrt(d.x * d.x + d.y * d.y + d.z * d.z);
+        if (length == 0) return {0, 0, 1};
+        return {d.x / length, d.y / length, d.z / length};
+    }
+
+    void writePoint(const Point& p) { out << p.x << " " << p.y << " " << p.z << "\n"; }
+
+    // Color, coefficients and shininess shared by every object type
+    void writeMaterial(const double color[3], bool mirror, int shine) {
+        out << color[0] << " " << color[1] << " " << color[2] << "\n";
+        out << "0.3 0.4 " << (shine > 1 ? 0.2 : 0.0) << " " << (mirror ? 0.3 : 0.0) << "\n";
+        out << shine << "\n\n";
+    }
+
+    void writeMaterial() {
+        double color[3] = {uniform(0.1, 1), uniform(0.1, 1), uniform(0.1, 1)};
+        writeMaterial(color, uniform(0, 1) < options.mirrorFraction, uniform_int_distribution<int>(1, 30)(rng));
+    }
+
+    void writeSphere() {
+        double radius = options.size * uniform(0.5, 1.5);
+        out << "sphere\n";
+        writePoint(place(radius));
+        out << radius << "\n";
+        writeMaterial();
+    }
+
+    void writeTriangle(const Point& a, const Point& b, const Point& c) {
+        out << "triangle\n";
+        writePoint(a);
+        writePoint(b);
+        writePoint(c);
+    }
+
+    // Independent triangle with random orientation
+    void writeSoupTriangle() {
+        double radius = options.size * uniform(0.5, 1.5);
+        Point center = place(radius), corners[3];
+        for (Point& corner : corners) {
+            Point d = randomDirection();
+            corner = {center.x + d.x * radius, center.y + d.y * radius, max(0.0, center.z + d.z * radius)};
+        }
+        writeTriangle(corners[0], corners[1], corners[2]);
+        writeMaterial();
+    }
+
+    // Closed latitude-longitude sphere of triangles in one material
+    void writeMesh() {
+        int rings = options.meshResolution, segments = 2 * rings;
+        double radius = options.size * 3 * uniform(0.5, 1.5);
+        Point center = place(radius);
+        double color[3] = {uniform(0.1, 1), uniform(0.1, 1), uniform(0.1, 1)};
+        bool mirror = uniform(0, 1) < options.mirrorFraction;
+        int shine = uniform_int_distribution<int>(1, 30)(rng);
+
+        auto vertex = [&](int ring, int segment) {
+            double theta = M_PI * ring / rings, phi = 2 * M_PI * segment / segments;
+            return Point{center.x + radius * sin(theta) * cos(phi), center.y + radius * sin(theta) * sin(phi),
+                         center.z + radius * cos(theta)};
+        };
+        for (int ring = 0; ring < rings; ring++) {
+            for (int segment = 0; segment < segments; segment++) {
+                Point a = vertex(ring, segment), b = vertex(ring, segment + 1);
+                Point c = vertex(ring + 1, segment), d = vertex(ring + 1, segment + 1);
+                // The pole rings have one triangle per segment, the others two
+                if (ring > 0) {
+                    writeTriangle(a, c, b);
+                    writeMaterial(color, mirror, shine);
+                }
+                if (ring < rings - 1) {
+                    writeTriangle(b, c, d);
+                    writeMaterial(color, mirror, shine);
+                }
+            }
+        }
+    }
+
+    // Ellipsoid, z-axis cylinder or z-axis cone, each clipped to its bounding box so the
+    // acceleration structure can bound it
+    void writeQuadric(int shape) {
+        double a = options.size * uniform(0.5, 1.5), b = options.size * uniform(0.5, 1.5);
+        double h = options.size * uniform(1, 3);
+        Point p = place(max(a, h));
+        double coeffs[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        Point boxCorner = {p.x - a, p.y - a, p.z - h};
+        double boxX = 2 * a, boxY = 2 * a, boxZ = 2 * h;
+        if (shape == 0) {
+            // (x-px)^2/a^2 + (y-py)^2/b^2 + (z-pz)^2/h^2 = 1
+            double inv[3] = {1 / (a * a), 1 / (b * b), 1 / (h * h)}, c[3] = {p.x, p.y, p.z};
+            coeffs[9] = -1;
+            for (int k = 0; k < 3; k++) {
+                coeffs[k] = inv[k];
+                coeffs[6 + k] = -2 * c[k] * inv[k];
+                coeffs[9] += c[k] * c[k] * inv[k];
+            }
+            boxCorner.y = p.y - b;
+            boxY = 2 * b;
+        } else if (shape == 1) {
+            // (x-px)^2 + (y-py)^2 = a^2 between pz - h and pz + h
+            coeffs[0] = coeffs[1] = 1;
+            coeffs[6] = -2 * p.x;
+            coeffs[7] = -2 * p.y;
+            coeffs[9] = p.x * p.x + p.y * p.y - a * a;
+        } else {
+            // (x-px)^2 + (y-py)^2 = k^2 (z-apex)^2 with the apex on top, a wide at the base
+            double apex = p.z + h, k2 = a * a / (4 * h * h);
+            coeffs[0] = coeffs[1] = 1;
+            coeffs[2] = -k2;
+            coeffs[6] = -2 * p.x;
+            coeffs[7] = -2 * p.y;
+            coeffs[8] = 2 * k2 * apex;
+            coeffs[9] = p.x * p.x + p.y * p.y - k2 * apex * apex;
+        }
+        out << "general\n";
+        for (int k = 0; k < 10; k++) out << coeffs[k] << (k < 9 ? " " : "\n");
+        out << boxCorner.x << " " << boxCorner.y << " " << boxCorner.z << " " << boxX << " " << boxY << " " << boxZ << "\n";
+        writeMaterial();
+    }
+
+    // Lights above the scene; their total brightness stays about the same for any light count
+    void writeLights() {
+        int total = max(1, options.pointLights + options.spotLights);
+        double intensity = min(1.0, 2.0 / total);
+        auto lightPosition = [&]() {
+            return Point{uniform(-options.extent, options.extent) * 1.5, uniform(-options.extent, options.extent) * 1.5,
+                         options.extent * uniform(1, 1.5)};
+        };
+        auto writeColor = [&]() {
+            out << intensity * uniform(0.7, 1) << " " << intensity * uniform(0.7, 1) << " "
+                << intensity * uniform(0.7, 1) << "\n";
+        };
+
+        out << options.pointLights << "\n";
+        for (int k = 0; k < options.pointLights; k++) {
+            writePoint(lightPosition());
+            writeColor();
+        }
+        out << "\n" << options.spotLights << "\n";
+        for (int k = 0; k < options.spotLights; k++) {
+            Point at = lightPosition();
+            writePoint(at);
+            writeColor();
+            out << -at.x << " " << -at.y << " " << -at.z << "\n";   // towards the origin
+            out << uniform(20, 45) << "\n";
+        }
+    }
+
+    const GeneratorOptions& options;
+    ostream& out;
+    mt19937 rng;
+    vector<Point> clusterCenters;
+};
+
+bool parseLayout(const string& name, Layout& layout) {
+    if (name == "uniform") layout = LAYOUT_UNIFORM;
+    else if (name == "clustered") layout = LAYOUT_CLUSTERED;
+    else if (name == "pile") layout = LAYOUT_PILE;
+    else return false;
+    return true;
+}
+
+void printUsage(const char* program) {
+    cout << "Usage: " << program << " [output_file] [options]" << endl;
+    cout << "Writes a random scene (default scene.txt); the same seed and options give the same scene" << endl;
+    cout << "Example: " << program << " big.txt --spheres 100000 --lights 16 --layout clustered --seed 7" << endl;
+    cout << "Options:" << endl;
+    cout << "  --seed N            random seed (default 1)" << endl;
+    cout << "  --spheres N         N spheres" << endl;
+    cout << "  --triangles N       N independent triangles (a triangle soup)" << endl;
+    cout << "  --meshes N          N closed triangle-mesh spheres" << endl;
+    cout << "  --mesh-res R        rings per mesh; 4*R*(R-1) triangles each (default 8)" << endl;
+    cout << "  --quadrics N        N bounded quadrics: ellipsoids, cylinders and cones" << endl;
+    cout << "  --lights N          N point lights (default 2)" << endl;
+    cout << "  --spotlights N      N spotlights aimed at the origin" << endl;
+    cout << "  --layout L          uniform (default), clustered, or pile (a dense heap on the floor)" << endl;
+    cout << "  --clusters N        cluster count for --layout clustered (default 8)" << endl;
+    cout << "  --extent E          objects lie within [-E, E] in x and y (default 80)" << endl;
+    cout << "  --size S            typical object radius (default 4)" << endl;
+    cout << "  --mirrors F         fraction of reflective objects (default 0.2)" << endl;
+    cout << "  --recursion N       recursion level written to the scene (default 3)" << endl;
+    cout << "  --image-size N      image width and height written to the scene (default 512)" << endl;
+}
+
+int main(int argc, char** argv) {
+    GeneratorOptions options;
+    string outputFile = "scene.txt";
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--seed" && hasValue) options.seed = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--spheres" && hasValue) options.spheres = max(0, atoi(argv[++i]));
+        else if (arg == "--triangles" && hasValue) options.triangles = max(0, atoi(argv[++i]));
+        else if (arg == "--meshes" && hasValue) options.meshes = max(0, atoi(argv[++i]));
+        else if (arg == "--mesh-res" && hasValue) options.meshResolution = max(2, atoi(argv[++i]));
+        else if (arg == "--quadrics" && hasValue) options.quadrics = max(0, atoi(argv[++i]));
+        else if (arg == "--lights" && hasValue) options.pointLights = max(0, atoi(argv[++i]));
+        else if (arg == "--spotlights" && hasValue) options.spotLights = max(0, atoi(argv[++i]));
+        else if (arg == "--clusters" && hasValue) options.clusters = max(1, atoi(argv[++i]));
+        else if (arg == "--extent" && hasValue) options.extent = max(1.0, atof(argv[++i]));
+        else if (arg == "--size" && hasValue) options.size = max(0.01, atof(argv[++i]));
+        else if (arg == "--mirrors" && hasValue) options.mirrorFraction = atof(argv[++i]);
+        else if (arg == "--recursion" && hasValue) options.recursion = max(1, atoi(argv[++i]));
+        else if (arg == "--image-size" && hasValue) options.imageSize = max(1, atoi(argv[++i]));
+        else if (arg == "--layout" && hasValue) {
+            if (!parseLayout(argv[++i], options.layout)) {
+                cout << "Unknown layout: " << argv[i] << endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg.rfind("--", 0) == 0) {
+            cout << "Unknown option: " << arg << endl;
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            outputFile = arg;
+        }
+    }
+
+    ofstream file(outputFile);
+    if (!file.is_open()) {
+        cout << "Error: Cannot write " << outputFile << endl;
+        return 1;
+    }
+    SceneGenerator(options, file).write();
+    if (!file) {
+        cout << "Error writing " << outputFile << endl;
+        return 1;
+    }
+    cout << "Scene written to " << outputFile << endl;
+    return 0;
+}
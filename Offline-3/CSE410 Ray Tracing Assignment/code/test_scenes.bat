@@ -5,7 +5,7 @@ echo ============================
 REM Check if raytracer exists
 if not exist raytracer.exe (
     echo ERROR: raytracer.exe not found. Please compile first:
-    echo g++ -o raytracer.exe 2005062_main.cpp intersection_implementations.cpp stb_image_impl.cpp -lfreeglut -lopengl32 -lglu32
+    echo g++ -o raytracer.exe 2005062_main.cpp intersection_implementations.cpp light_table.cpp light_tree.cpp renderer.cpp tile_cache.cpp reprojection.cpp hybrid.cpp checkpoint.cpp budget.cpp tiled_output.cpp image_io.cpp traversal.cpp render_stats.cpp perf_counters.cpp heatmap.cpp trace.cpp tile_frustum.cpp scene.cpp bvh.cpp stb_image_impl.cpp -lfreeglut -lopengl32 -lglu32
     pause
     exit /b 1
 )
@@ -7,7 +7,7 @@ Write-Host "============================" -ForegroundColor Green
 # Check if raytracer exists
 if (-not (Test-Path "raytracer_headless.exe")) {
     Write-Host "Error: raytracer_headless.exe not found. Please compile first:" -ForegroundColor Red
-    Write-Host "g++ -o raytracer_headless.exe code\raytracer_headless.cpp intersection_implementations.cpp stb_image_impl.cpp"
+    Write-Host "g++ -o raytracer_headless.exe code\raytracer_headless.cpp intersection_implementations.cpp light_table.cpp light_tree.cpp renderer.cpp tile_cache.cpp reprojection.cpp hybrid.cpp checkpoint.cpp budget.cpp tiled_output.cpp image_io.cpp traversal.cpp render_stats.cpp perf_counters.cpp heatmap.cpp trace.cpp tile_frustum.cpp scene.cpp bvh.cpp stb_image_impl.cpp"
     exit 1
 }
 
@@ -0,0 +1,136 @@
+#include "tile_cache.h"
+#include "light_table.h"
+#include <cmath>
+#include <algorithm>
+
+thread_local TileRecord* activeTileRecord = nullptr;
+
+void TileRecord::clear() {
+    objects.clear();
+    primaryDirections = Bounds();
+    secondaryOrigins = Bounds();
+    secondaryDirections = Bounds();
+    shadowOrigins = Bounds();
+}
+
+void TileRecord::finish() {
+    std::sort(objects.begin(), objects.end());
+    objects.erase(std::unique(objects.begin(), objects.end()), objects.end());
+}
+
+void TileCache::resize(const Camera& cam, int w, int h) {
+    camera = cam;
+    width = w;
+    height = h;
+    tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+    tiles.assign(tilesX * tilesY, TileRecord());
+    dirty.assign(tilesX * tilesY, 1);
+}
+
+bool TileCache::matches(const Camera& cam, int w, int h) const {
+    return !tiles.empty() && width == w && height == h && sameCamera(camera, cam);
+}
+
+void TileCache::markAllDirty() {
+    std::fill(dirty.begin(), dirty.end(), 1);
+}
+
+void TileCache::markAllClean() {
+    std::fill(dirty.begin(), dirty.end(), 0);
+}
+
+int TileCache::dirtyCount() const {
+    return std::count(dirty.begin(), dirty.end(), 1);
+}
+
+// Smallest cone (axis, half-angle) around the unit directions inside a box of directions
+static void directionCone(const Bounds& directions, Vector3D& axis, double& angle) {
+    axis = directions.center();
+    if (axis.length() < 1e-9) {
+        angle = M_PI;
+        return;
+    }
+    axis = axis.normalize();
+    double minCos = 1.0;
+    for (int corner = 0; corner < 8; corner++) {
+        Vector3D p((corner & 1) ? directions.max.x : directions.min.x,
+                   (corner & 2) ? directions.max.y : directions.min.y,
+                   (corner & 4) ? directions.max.z : directions.min.z);
+        double len = p.length();
+        if (len < 1e-9) {
+            angle = M_PI;
+            return;
+        }
+        minCos = std::min(minCos, axis.dot(p) / len);
+    }
+    // Past 90 degrees the corners no longer bound the directions in the box
+    angle = minCos <= 0 ? M_PI : acos(minCos);
+}
+
+// Angle between two vectors
+static double angleBetween(const Vector3D& a, const Vector3D& b) {
+    double len = a.length() * b.length();
+    if (len <= 0) return 0;
+    return acos(std::max(-1.0, std::min(1.0, a.dot(b) / len)));
+}
+
+// Can a ray starting inside 'origins' with a direction inside 'directions' reach 'target'?
+static bool raysMayReach(const Bounds& origins, const Bounds& directions, const Bounds& target) {
+    if (origins.isEmpty() || directions.isEmpty()) return false;
+
+    Vector3D toTarget = target.center() - origins.center();
+    double distance = toTarget.length();
+    double reach = origins.radius() + target.radius();
+    if (distance <= reach) return true;
+
+    Vector3D axis;
+    double spread;
+    directionCone(directions, axis, spread);
+    if (spread >= M_PI) return true;
+    return angleBetween(axis, toTarget) <= spread + asin(reach / distance);
+}
+
+// Can a shadow ray from a point inside 'origins' towards 'light' (continuing past it) hit 'target'?
+// Every point on such a ray lies along +/-(origin - light) as seen from the light.
+static bool shadowRaysMayReach(const Bounds& origins, const Vector3D& light, const Bounds& target) {
+    if (origins.isEmpty()) return false;
+
+    Vector3D toOrigins = origins.center() - light;
+    Vector3D toTarget = target.center() - light;
+    if (toOrigins.length() <= origins.radius() || toTarget.length() <= target.radius()) return true;
+
+    double spread = asin(origins.radius() / toOrigins.length()) + asin(target.radius() / toTarget.length());
+    double angle = angleBetween(toOrigins, toTarget);
+    return angle <= spread || M_PI - angle <= spread;
+}
+
+static bool tileMayReach(const TileRecord& tile, const Camera& camera, const Bounds& bounds) {
+    if (bounds.isEmpty()) return false;
+    if (raysMayReach(Bounds(camera.eye, camera.eye), tile.primaryDirections, bounds)) return true;
+    if (raysMayReach(tile.secondaryOrigins, tile.secondaryDirections, bounds)) return true;
+    for (int l = 0; l < lightTable.size(); l++) {
+        Vector3D light(lightTable.posX[l], lightTable.posY[l], lightTable.posZ[l]);
+        if (shadowRaysMayReach(tile.shadowOrigins, light, bounds)) return true;
+    }
+    return false;
+}
+
+int TileCache::invalidateObject(int id, const Bounds& oldBounds, const Bounds& newBounds) {
+    if (!oldBounds.isFinite() || !newBounds.isFinite()) {
+        markAllDirty();
+        return tiles.size();
+    }
+
+    int marked = 0;
+    for (int t = 0; t < (int)tiles.size(); t++) {
+        if (dirty[t]) continue;
+        const TileRecord& tile = tiles[t];
+        if (std::binary_search(tile.objects.begin(), tile.objects.end(), id)
+            || tileMayReach(tile, camera, oldBounds) || tileMayReach(tile, camera, newBounds)) {
+            dirty[t] = 1;
+            marked++;
+        }
+    }
+    return marked;
+}
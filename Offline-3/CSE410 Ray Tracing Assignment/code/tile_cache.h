@@ -0,0 +1,47 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include <vector>
+#include "2005062_classes.h"
+#include "renderer.h"
+
+// What the rays of one image tile touched during the last render
+struct TileRecord {
+    std::vector<int> objects;       // hit by a primary/reflection ray or blocking a shadow ray
+    Bounds primaryDirections;       // unit directions of primary rays (all start at the eye)
+    Bounds secondaryOrigins;        // reflection ray origins
+    Bounds secondaryDirections;     // reflection ray directions
+    Bounds shadowOrigins;           // points that cast shadow rays (towards every light)
+
+    void clear();
+    void addObject(int id) { objects.push_back(id); }
+    void finish();                  // sort and deduplicate objects
+};
+
+// Per-tile records of the last render, used to re-render only tiles a scene edit can affect
+class TileCache {
+public:
+    static const int TILE_SIZE = 16;
+
+    Camera camera;
+    int width = 0, height = 0;
+    int tilesX = 0, tilesY = 0;
+    std::vector<TileRecord> tiles;
+    std::vector<char> dirty;
+
+    void resize(const Camera& camera, int width, int height);
+    void clear() { tiles.clear(); dirty.clear(); width = height = 0; }
+    bool matches(const Camera& camera, int width, int height) const;
+
+    // Conservatively mark tiles whose rays touched object 'id' or may pass through
+    // its old or new bounds. Returns the number of tiles marked.
+    int invalidateObject(int id, const Bounds& oldBounds, const Bounds& newBounds);
+    void markAllDirty();
+    void markAllClean();
+    int dirtyCount() const;
+};
+
+// Record of the tile being rendered on this thread, or null when not recording
+extern thread_local TileRecord* activeTileRecord;
+
+#endif // TILE_CACHE_H
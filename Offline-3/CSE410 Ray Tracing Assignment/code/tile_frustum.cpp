@@ -0,0 +1,94 @@
+#include "tile_frustum.h"
+#include "tile_cache.h"
+#include "render_stats.h"
+#include "bvh.h"
+#include <cmath>
+#include <algorithm>
+
+TileFrustum::TileFrustum(const ImagePlane& plane, int x0, int y0, int x1, int y1) : eye(plane.eye) {
+    // Pixel centers run from x0 to x1 - 1; one pixel further out is half a pixel past the edge
+    double left = x0 - 1, right = x1, top = y0 - 1, bottom = y1;
+    auto through = [&](double i, double j) {
+        return plane.topleft + plane.right * (i * plane.du) - plane.up * (j * plane.dv) - eye;
+    };
+    corner[0] = through(left, top);
+    corner[1] = through(right, top);
+    corner[2] = through(right, bottom);
+    corner[3] = through(left, bottom);
+
+    Vector3D center = corner[0] + corner[1] + corner[2] + corner[3];
+    for (int k = 0; k < 4; k++) {
+        normal[k] = corner[k].cross(corner[(k + 1) % 4]);
+        if (normal[k].dot(center) < 0) normal[k] = normal[k] * -1;
+    }
+    normal[4] = plane.up.cross(plane.right);
+}
+
+bool TileFrustum::mayOverlap(const Bounds& box) const {
+    for (const Vector3D& n : normal) {
+        // The box corner furthest along the normal decides
+        Vector3D far(n.x >= 0 ? box.max.x : box.min.x, n.y >= 0 ? box.max.y : box.min.y,
+                     n.z >= 0 ? box.max.z : box.min.z);
+        if (n.dot(far - eye) < 0) return false;
+    }
+    return true;
+}
+
+bool TileFrustum::mayHitFloor(const Floor& floor) const {
+    // Every ray of the tile is a positive mix of the corner rays, so the corners decide
+    // whether any of them heads down to the plane and where the hits can land
+    double height = eye.z;
+    if (height == 0) return true;
+    double half = floor.floorWidth / 2.0;
+    double minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+    int reaching = 0;
+    for (const Vector3D& d : corner) {
+        if (d.z * height >= 0) continue;     // parallel to the plane or heading away from it
+        reaching++;
+        double t = -height / d.z;
+        minX = std::min(minX, eye.x + d.x * t);
+        maxX = std::max(maxX, eye.x + d.x * t);
+        minY = std::min(minY, eye.y + d.y * t);
+        maxY = std::max(maxY, eye.y + d.y * t);
+    }
+    if (reaching == 0) return false;
+    // With the horizon inside the tile the hits reach arbitrarily far out
+    if (reaching < 4) return true;
+    return maxX >= -half && minX <= half && maxY >= -half && minY <= half;
+}
+
+bool TileObjects::gather(const TileFrustum& frustum, const std::vector<char>* include) {
+    auto keep = [&](int k) {
+        if (include && !(*include)[k]) return false;
+        if (const Floor* floor = dynamic_cast<const Floor*>(objects[k])) return frustum.mayHitFloor(*floor);
+        Bounds box = objects[k]->getBounds();
+        return !box.isFinite() || frustum.mayOverlap(box);
+    };
+    if (sceneBVH.usable()) {
+        return sceneBVH.collect([&](const Bounds& box) { return frustum.mayOverlap(box); }, keep, MAX_OBJECTS,
+                                indices);
+    }
+
+    // Without the BVH any culling beats testing every object, so there is no limit
+    indices.clear();
+    for (int k = 0; k < (int)objects.size(); k++) {
+        if (keep(k)) indices.push_back(k);
+    }
+    return true;
+}
+
+int TileObjects::nearest(Ray* ray, double& tMin) const {
+    rayCounters.nearest++;
+    rayCounters.primitiveTests += indices.size();
+    tMin = -1;
+    int nearest = -1;
+    for (int k : indices) {
+        double t = objects[k]->intersect(ray, nullptr, 0);
+        if (t > 0 && (tMin < 0 || t < tMin)) {
+            tMin = t;
+            nearest = k;
+        }
+    }
+    if (activeTileRecord && nearest != -1) activeTileRecord->addObject(nearest);
+    return nearest;
+}
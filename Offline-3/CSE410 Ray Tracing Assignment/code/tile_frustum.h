@@ -0,0 +1,40 @@
+#ifndef TILE_FRUSTUM_H
+#define TILE_FRUSTUM_H
+
+#include <vector>
+#include "renderer.h"
+
+// Volume swept by the primary rays of one tile: four side planes through the eye plus one
+// facing along the view direction, normals pointing inwards
+struct TileFrustum {
+    Vector3D eye;
+    Vector3D corner[4];     // ray directions through the tile's corners, clockwise from the top left
+    Vector3D normal[5];
+
+    // Pixels x0 <= i < x1, y0 <= j < y1 of plane, widened by half a pixel past their edges so
+    // rounding never leaves an edge ray outside
+    TileFrustum(const ImagePlane& plane, int x0, int y0, int x1, int y1);
+
+    // False only if no point of the box is inside
+    bool mayOverlap(const Bounds& box) const;
+    // False only if none of the tile's rays meets the floor's square on z = 0
+    bool mayHitFloor(const Floor& floor) const;
+};
+
+// The objects a tile's primary rays can hit, found once per tile so each ray only tests those
+struct TileObjects {
+    // Past this many the tile's rays are better off in the scene BVH
+    static const int MAX_OBJECTS = 16;
+
+    std::vector<int> indices;   // ascending, so equal hits still go to the lowest index
+
+    // Cull the scene, or with include only objects k with (*include)[k] set, against the
+    // frustum. With sceneBVH usable, false if more than MAX_OBJECTS survive or the tree has to
+    // be opened too far to tell; indices is incomplete then.
+    bool gather(const TileFrustum& frustum, const std::vector<char>* include = nullptr);
+
+    // Same result and bookkeeping as findNearestObject, testing only these objects
+    int nearest(Ray* ray, double& tMin) const;
+};
+
+#endif // TILE_FRUSTUM_H
@@ -0,0 +1,287 @@
+#include "tiled_output.h"
+#include "image_io.h"
+#include "render_stats.h"
+#include "trace.h"
+#include "light_tree.h"
+#include "tile_frustum.h"
+#include <cmath>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static bool seekTo(FILE* file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// Append a little-endian integer of 'bytes' bytes
+static void putLE(std::vector<unsigned char>& out, uint64_t value, int bytes) {
+    for (int b = 0; b < bytes; b++) out.push_back((value >> (8 * b)) & 0xFF);
+}
+
+bool TiledImageWriter::open(const std::string& filePath, int w, int h, int size) {
+    path = filePath;
+    width = w;
+    height = h;
+    tileSize = size;
+    failed = false;
+    // Read access too, so the file can also be mapped
+    file = fopen(path.c_str(), "w+b");
+    if (!file) return false;
+    if (!writeLayout(dataStart)) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void TiledImageWriter::writeTile(int tx, int ty, const unsigned char* rgb) {
+    uint64_t offset = dataStart + (uint64_t)(ty * tilesX() + tx) * tileBytes();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file || !seekTo(file, offset) || fwrite(rgb, 1, tileBytes(), file) != tileBytes()) failed = true;
+}
+
+bool TiledImageWriter::close() {
+    if (!file) return false;
+    bool ok = fclose(file) == 0 && !failed;
+    file = nullptr;
+    return ok;
+}
+
+bool BigTiffWriter::writeLayout(uint64_t& dataStart) {
+    if (tileSize % 16 != 0) return false;   // TIFF requires tile sizes in multiples of 16
+
+    const int SHORT = 3, LONG = 4, LONG8 = 16;
+    const int ENTRIES = 11;
+    uint64_t numTiles = (uint64_t)tilesX() * tilesY();
+    uint64_t ifdSize = 8 + ENTRIES * 20 + 8;
+    uint64_t offsetsAt = (16 + ifdSize + 7) / 8 * 8;
+    uint64_t countsAt = offsetsAt + numTiles * 8;
+    dataStart = countsAt + numTiles * 8;
+
+    std::vector<unsigned char> head;
+    // Header: byte order, BigTIFF version, offset size, first IFD right after
+    head.push_back('I'); head.push_back('I');
+    putLE(head, 43, 2); putLE(head, 8, 2); putLE(head, 0, 2);
+    putLE(head, 16, 8);
+
+    // One IFD entry; values up to 8 bytes are stored in the entry itself
+    auto entry = [&head](int tag, int type, uint64_t count, uint64_t value) {
+        putLE(head, tag, 2); putLE(head, type, 2); putLE(head, count, 8); putLE(head, value, 8);
+    };
+    putLE(head, ENTRIES, 8);
+    entry(256, LONG, 1, width);                             // ImageWidth
+    entry(257, LONG, 1, height);                            // ImageLength
+    entry(258, SHORT, 3, 8 | (8ULL << 16) | (8ULL << 32));  // BitsPerSample 8,8,8
+    entry(259, SHORT, 1, 1);                                // Compression: none
+    entry(262, SHORT, 1, 2);                                // PhotometricInterpretation: RGB
+    entry(277, SHORT, 1, 3);                                // SamplesPerPixel
+    entry(284, SHORT, 1, 1);                                // PlanarConfiguration: chunky
+    entry(322, LONG, 1, tileSize);                          // TileWidth
+    entry(323, LONG, 1, tileSize);                          // TileLength
+    entry(324, LONG8, numTiles, numTiles == 1 ? dataStart : offsetsAt);     // TileOffsets
+    entry(325, LONG8, numTiles, numTiles == 1 ? tileBytes() : countsAt);    // TileByteCounts
+    putLE(head, 0, 8);                                      // no next IFD
+    head.resize(offsetsAt, 0);
+    if (fwrite(head.data(), 1, head.size(), file) != head.size()) return false;
+    if (numTiles == 1) return true;
+
+    // Both tables follow from the fixed tile size, so they are streamed out in chunks
+    std::vector<unsigned char> chunk;
+    for (int table = 0; table < 2; table++) {
+        for (uint64_t t = 0; t < numTiles; t++) {
+            putLE(chunk, table == 0 ? dataStart + t * tileBytes() : tileBytes(), 8);
+            if (chunk.size() >= 65536 || t + 1 == numTiles) {
+                if (fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size()) return false;
+                chunk.clear();
+            }
+        }
+    }
+    return true;
+}
+
+bool RawTileWriter::writeLayout(uint64_t& dataStart) {
+    dataStart = 0;
+    std::ofstream index(path + ".idx");
+    index << "# 8-bit RGB tiles, row-major inside each tile, tiles in row-major order" << std::endl;
+    index << "# tile (tx, ty) starts at byte (ty * tiles_x + tx) * tile_size * tile_size * 3" << std::endl;
+    index << "width " << width << std::endl;
+    index << "height " << height << std::endl;
+    index << "tile_size " << tileSize << std::endl;
+    index << "tiles_x " << tilesX() << std::endl;
+    index << "tiles_y " << tilesY() << std::endl;
+    return (bool)index;
+}
+
+bool MappedBmpWriter::writeLayout(uint64_t& dataStart) {
+    dataStart = 54;
+    if (fileSize() > 0xFFFFFFFFull) return false;   // BMP sizes are 32-bit
+
+    std::vector<unsigned char> header = {'B', 'M'};
+    putLE(header, fileSize(), 4);
+    putLE(header, 0, 4);                    // reserved
+    putLE(header, 54, 4);                   // pixel data offset
+    putLE(header, 40, 4);                   // BITMAPINFOHEADER
+    putLE(header, width, 4);
+    putLE(header, height, 4);               // positive: rows stored bottom-up
+    putLE(header, 1, 2);                    // planes
+    putLE(header, 24, 2);                   // bits per pixel
+    putLE(header, 0, 4);                    // no compression
+    putLE(header, rowStride() * height, 4);
+    putLE(header, 0, 16);                   // resolution and palette counts
+    return fwrite(header.data(), 1, header.size(), file) == header.size();
+}
+
+bool MappedBmpWriter::open(const std::string& filePath, int w, int h, int size) {
+    if (!TiledImageWriter::open(filePath, w, h, size)) return false;
+    fflush(file);
+
+    // Size the file up front (the padding bytes come out zero), then map all of it
+#ifdef _WIN32
+    bool mapped = _chsize_s(_fileno(file), fileSize()) == 0;
+    if (mapped) {
+        HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+        mappingHandle = CreateFileMappingA(handle, NULL, PAGE_READWRITE, 0, 0, NULL);
+        if (mappingHandle) mapping = (unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_WRITE, 0, 0, 0);
+        mapped = mapping != nullptr;
+    }
+#else
+    bool mapped = ftruncate(fileno(file), fileSize()) == 0;
+    if (mapped) {
+        void* address = mmap(nullptr, fileSize(), PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+        mapping = address == MAP_FAILED ? nullptr : (unsigned char*)address;
+        mapped = mapping != nullptr;
+    }
+#endif
+    if (!mapped) {
+        unmap();
+        TiledImageWriter::close();
+        return false;
+    }
+    return true;
+}
+
+void MappedBmpWriter::writeTile(int tx, int ty, const unsigned char* rgb) {
+    // Tiles never overlap, so workers write without locking
+    int x0 = tx * tileSize, y0 = ty * tileSize;
+    int x1 = std::min(width, x0 + tileSize), y1 = std::min(height, y0 + tileSize);
+    for (int j = y0; j < y1; j++) {
+        const unsigned char* from = rgb + (size_t)(j - y0) * tileSize * 3;
+        unsigned char* to = mapping + 54 + (uint64_t)(height - 1 - j) * rowStride() + (uint64_t)x0 * 3;
+        for (int i = 0; i < x1 - x0; i++, from += 3, to += 3) {
+            to[0] = from[2];
+            to[1] = from[1];
+            to[2] = from[0];
+        }
+    }
+}
+
+bool MappedBmpWriter::unmap() {
+    bool ok = true;
+#ifdef _WIN32
+    if (mapping) ok = FlushViewOfFile(mapping, 0) && UnmapViewOfFile(mapping);
+    if (mappingHandle) CloseHandle(mappingHandle);
+    mappingHandle = nullptr;
+#else
+    if (mapping) ok = munmap(mapping, fileSize()) == 0;
+#endif
+    mapping = nullptr;
+    return ok;
+}
+
+bool MappedBmpWriter::close() {
+    if (!file) return false;
+    bool unmapped = unmap();
+    return TiledImageWriter::close() && unmapped;
+}
+
+TiledImageWriter* tiledWriterFor(const std::string& path) {
+    if (hasExtension(path, ".tif") || hasExtension(path, ".tiff")) return new BigTiffWriter();
+    if (hasExtension(path, ".raw")) return new RawTileWriter();
+    return nullptr;
+}
+
+bool renderTiled(const Camera& camera, int width, int height, int tileSize, TiledImageWriter& writer,
+                 bitmap_image* preview, const RenderOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    ImagePlane plane(camera, width, height);
+    int tilesX = writer.tilesX(), tilesY = writer.tilesY();
+    std::vector<int> tileOrder = tileSequence(tilesX, tilesY, options.tileOrder);
+
+    // Box-filtered preview sums, one preview pixel per scale x scale block
+    int scale = std::max(1, (std::max(width, height) + STREAM_PREVIEW_SIZE - 1) / STREAM_PREVIEW_SIZE);
+    int previewWidth = (width + scale - 1) / scale, previewHeight = (height + scale - 1) / scale;
+    std::vector<float> previewSums(preview ? previewWidth * previewHeight * 3 : 0, 0.0f);
+    std::mutex previewMutex;
+
+    auto renderTile = [&](int step) {
+        static thread_local std::vector<unsigned char> pixels;
+        pixels.assign(tileSize * tileSize * 3, 0);
+        TileStart started = tileStart();
+
+        int tile = tileOrder[step];
+        TraceScope span("tile", "render", "tile", tile);
+        int tx = tile % tilesX, ty = tile / tilesX;
+        int x0 = tx * tileSize, y0 = ty * tileSize;
+        int x1 = std::min(width, x0 + tileSize), y1 = std::min(height, y0 + tileSize);
+        static thread_local TileObjects tileObjects;
+        bool culled = options.frustumCulling && tileObjects.gather(TileFrustum(plane, x0, y0, x1, y1));
+        for (int offset : pixelSequence(tileSize, options.pixelOrder)) {
+            int i = x0 + offset % tileSize, j = y0 + offset / tileSize;
+            if (i >= x1 || j >= y1) continue;
+            seedLightSampling(i, j, 0);
+            Vector3D color = tracePixel(plane, i, j, nullptr, nullptr, culled ? &tileObjects : nullptr);
+            unsigned char* p = &pixels[offset * 3];
+            p[0] = (unsigned char)(clamp(color.x, 0.0, 1.0) * 255);
+            p[1] = (unsigned char)(clamp(color.y, 0.0, 1.0) * 255);
+            p[2] = (unsigned char)(clamp(color.z, 0.0, 1.0) * 255);
+        }
+        {
+            TraceScope writeSpan("encode tile", "output", "tile", tile);
+            writer.writeTile(tx, ty, pixels.data());
+        }
+        if (options.stats) options.stats->addTile((x1 - x0) * (y1 - y0), started);
+        if (options.stats && culled) options.stats->addCulledTile(tileObjects.indices.empty());
+
+        if (preview) {
+            std::lock_guard<std::mutex> lock(previewMutex);
+            for (int j = y0; j < y1; j++) {
+                for (int i = x0; i < x1; i++) {
+                    const unsigned char* p = &pixels[((j - y0) * tileSize + (i - x0)) * 3];
+                    float* sum = &previewSums[((j / scale) * previewWidth + i / scale) * 3];
+                    sum[0] += p[0]; sum[1] += p[1]; sum[2] += p[2];
+                }
+            }
+        }
+        return true;
+    };
+    forEachTile((int)tileOrder.size(), options.threads, renderTile);
+    if (options.stats) {
+        options.stats->renderSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    if (preview) {
+        preview->setwidth_height(previewWidth, previewHeight);
+        for (int py = 0; py < previewHeight; py++) {
+            for (int px = 0; px < previewWidth; px++) {
+                // Blocks on the right and bottom edges may be cut short
+                int count = std::min(scale, width - px * scale) * std::min(scale, height - py * scale);
+                const float* sum = &previewSums[(py * previewWidth + px) * 3];
+                preview->set_pixel(px, py, (unsigned char)(sum[0] / count + 0.5f),
+                                   (unsigned char)(sum[1] / count + 0.5f), (unsigned char)(sum[2] / count + 0.5f));
+            }
+        }
+    }
+    return writer.close();
+}
@@ -0,0 +1,92 @@
+#ifndef TILED_OUTPUT_H
+#define TILED_OUTPUT_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <mutex>
+#include "renderer.h"
+
+// Image written to disk tile by tile, for frames too large to keep in memory.
+// Tiles are fixed size and stored at offsets computed from their index, so workers can
+// write them in any order and nothing per tile is kept in memory.
+class TiledImageWriter {
+public:
+    virtual ~TiledImageWriter() {}
+
+    virtual bool open(const std::string& path, int width, int height, int tileSize);
+    // Store a tile of tileSize x tileSize RGB pixels, row-major; pixels past the image edge
+    // are padding. Safe to call from concurrent workers.
+    virtual void writeTile(int tx, int ty, const unsigned char* rgb);
+    virtual bool close();
+
+    int tilesX() const { return (width + tileSize - 1) / tileSize; }
+    int tilesY() const { return (height + tileSize - 1) / tileSize; }
+
+protected:
+    uint64_t tileBytes() const { return (uint64_t)tileSize * tileSize * 3; }
+    // Write the headers; returns the file offset of the first tile
+    virtual bool writeLayout(uint64_t& dataStart) = 0;
+
+    FILE* file = nullptr;
+    std::string path;
+    int width = 0, height = 0, tileSize = 0;
+
+private:
+    std::mutex mutex;
+    uint64_t dataStart = 0;
+    bool failed = false;
+};
+
+// BigTIFF (64-bit offsets) with uncompressed RGB tiles; tileSize must be a multiple of 16
+class BigTiffWriter : public TiledImageWriter {
+protected:
+    bool writeLayout(uint64_t& dataStart) override;
+};
+
+// Raw RGB tiles in row-major tile order, described by a text index next to it (<path>.idx)
+class RawTileWriter : public TiledImageWriter {
+protected:
+    bool writeLayout(uint64_t& dataStart) override;
+};
+
+// 24-bit BMP whose pixel area is memory-mapped; tiles are stored straight into the mapping
+// (bottom-up rows, BGR, rows padded to 4 bytes), so there is no frame buffer and no final write
+class MappedBmpWriter : public TiledImageWriter {
+public:
+    ~MappedBmpWriter() { close(); }
+
+    bool open(const std::string& path, int width, int height, int tileSize) override;
+    void writeTile(int tx, int ty, const unsigned char* rgb) override;
+    bool close() override;
+
+protected:
+    bool writeLayout(uint64_t& dataStart) override;
+
+private:
+    uint64_t rowStride() const { return ((uint64_t)width * 3 + 3) & ~(uint64_t)3; }
+    uint64_t fileSize() const { return 54 + rowStride() * height; }
+    bool unmap();
+
+    unsigned char* mapping = nullptr;
+#ifdef _WIN32
+    void* mappingHandle = nullptr;
+#endif
+};
+
+// Writer for an output path by extension (.tif/.tiff or .raw); nullptr for other formats
+TiledImageWriter* tiledWriterFor(const std::string& path);
+
+// Tile size of streamed renders; one tile per worker is all that is held in memory
+const int STREAM_TILE_SIZE = 256;
+
+// Largest side of the preview written next to a streamed render
+const int STREAM_PREVIEW_SIZE = 1024;
+
+// Render a width x height frame straight into writer, tileSize x tileSize tiles at a time.
+// Memory use depends on the tile size and thread count, not the frame size. When preview is
+// given it is resized to a box-filtered copy no larger than STREAM_PREVIEW_SIZE.
+bool renderTiled(const Camera& camera, int width, int height, int tileSize, TiledImageWriter& writer,
+                 bitmap_image* preview, const RenderOptions& options);
+
+#endif // TILED_OUTPUT_H
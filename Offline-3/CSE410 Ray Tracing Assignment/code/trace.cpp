@@ -0,0 +1,82 @@
+#include "trace.h"
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+bool traceEnabled = false;
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    const char* category;
+    const char* argName;
+    long argValue;
+    int thread;
+    double startUs, durationUs;
+};
+
+std::mutex traceMutex;
+std::vector<TraceEvent> events;
+std::chrono::steady_clock::time_point traceStart;
+std::atomic<int> nextThread(0);
+int mainThread = 0;
+
+// Small id of the calling thread, given out on its first span
+int threadId() {
+    static thread_local int id = -1;
+    if (id < 0) id = nextThread++;
+    return id;
+}
+
+double sinceStartUs(std::chrono::steady_clock::time_point at) {
+    return std::chrono::duration<double, std::micro>(at - traceStart).count();
+}
+
+} // namespace
+
+void startTrace() {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    events.clear();
+    events.reserve(4096);
+    traceStart = std::chrono::steady_clock::now();
+    mainThread = threadId();
+    traceEnabled = true;
+}
+
+void traceSpan(const char* name, const char* category, std::chrono::steady_clock::time_point start,
+               std::chrono::steady_clock::time_point end, const char* argName, long argValue) {
+    int thread = threadId();
+    TraceEvent event{name, category, argName, argValue, thread, sinceStartUs(start),
+                     std::chrono::duration<double, std::micro>(end - start).count()};
+    std::lock_guard<std::mutex> lock(traceMutex);
+    events.push_back(event);
+}
+
+bool writeTrace(const std::string& path) {
+    traceEnabled = false;
+    std::lock_guard<std::mutex> lock(traceMutex);
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) return false;
+
+    // Thread names first, then one complete ("X") event per span
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    int threads = nextThread;
+    for (int thread = 0; thread < threads; thread++) {
+        std::string name = thread == mainThread ? "main" : "worker " + std::to_string(thread);
+        fprintf(file, "%s{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                thread ? ",\n" : "", thread, name.c_str());
+    }
+    for (const TraceEvent& event : events) {
+        fprintf(file, ",\n{\"ph\": \"X\", \"name\": \"%s\", \"cat\": \"%s\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                event.name, event.category, event.thread, event.startUs, event.durationUs);
+        if (event.argName) fprintf(file, ", \"args\": {\"%s\": %ld}", event.argName, event.argValue);
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n]}\n");
+    bool written = !ferror(file);
+    written = fclose(file) == 0 && written;
+    events.clear();
+    return written;
+}
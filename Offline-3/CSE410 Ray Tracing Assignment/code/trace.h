@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <string>
+
+// Timeline of what each thread did, saved in Chrome's Trace Event format for chrome://tracing
+// or ui.perfetto.dev. Spans are only recorded between startTrace and writeTrace; otherwise a
+// span costs one flag check.
+
+extern bool traceEnabled;
+
+// Start recording; the calling thread shows up as "main"
+void startTrace();
+
+// Stop recording and write everything recorded to path as JSON; false if it cannot be written
+bool writeTrace(const std::string& path);
+
+// Record a finished span of the calling thread. argName/argValue become the span's one argument
+// when argName is given.
+void traceSpan(const char* name, const char* category, std::chrono::steady_clock::time_point start,
+               std::chrono::steady_clock::time_point end, const char* argName = nullptr, long argValue = 0);
+
+// Records its own lifetime as a span
+class TraceScope {
+public:
+    TraceScope(const char* name, const char* category, const char* argName = nullptr, long argValue = 0)
+        : name(traceEnabled ? name : nullptr), category(category), argName(argName), argValue(argValue) {
+        if (this->name) start = std::chrono::steady_clock::now();
+    }
+    ~TraceScope() {
+        if (name && traceEnabled) traceSpan(name, category, start, std::chrono::steady_clock::now(), argName, argValue);
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;       // null when tracing was off at construction
+    const char* category;
+    const char* argName;
+    long argValue;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif // TRACE_H
@@ -0,0 +1,94 @@
+#include "traversal.h"
+#include <cstdint>
+#include <algorithm>
+
+const char* traversalOrderName(TraversalOrder order) {
+    switch (order) {
+        case ORDER_MORTON: return "morton";
+        case ORDER_HILBERT: return "hilbert";
+        default: return "rows";
+    }
+}
+
+bool parseTraversalOrder(const std::string& name, TraversalOrder& order) {
+    if (name == "rows") order = ORDER_ROWS;
+    else if (name == "morton") order = ORDER_MORTON;
+    else if (name == "hilbert") order = ORDER_HILBERT;
+    else return false;
+    return true;
+}
+
+// Spread the low 16 bits of v to the even bit positions
+static uint32_t spreadBits(uint32_t v) {
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+static uint32_t mortonCode(int x, int y) {
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+// Cell (x, y) at distance d along the Hilbert curve filling an n x n grid (n a power of two)
+static void hilbertCell(int n, int d, int& x, int& y) {
+    x = y = 0;
+    for (int s = 1; s < n; s *= 2) {
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+        // Rotate the quadrant so the curve enters and leaves at the right corners
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+}
+
+// Cells of a width x height grid as y * width + x, in the given order
+static std::vector<int> gridSequence(int width, int height, TraversalOrder order) {
+    std::vector<int> cells;
+    cells.reserve(width * height);
+    if (order == ORDER_HILBERT) {
+        // Walk the curve over the enclosing power-of-two square, skipping cells outside the grid
+        int n = 1;
+        while (n < width || n < height) n *= 2;
+        for (int d = 0; d < n * n; d++) {
+            int x, y;
+            hilbertCell(n, d, x, y);
+            if (x < width && y < height) cells.push_back(y * width + x);
+        }
+        return cells;
+    }
+
+    for (int cell = 0; cell < width * height; cell++) cells.push_back(cell);
+    if (order == ORDER_MORTON) {
+        std::sort(cells.begin(), cells.end(), [width](int a, int b) {
+            return mortonCode(a % width, a / width) < mortonCode(b % width, b / width);
+        });
+    }
+    return cells;
+}
+
+std::vector<int> tileSequence(int tilesX, int tilesY, TraversalOrder order) {
+    return gridSequence(tilesX, tilesY, order);
+}
+
+const std::vector<int>& pixelSequence(int size, TraversalOrder order) {
+    static thread_local std::vector<int> sequence;
+    static thread_local int cachedSize = -1;
+    static thread_local TraversalOrder cachedOrder = ORDER_ROWS;
+    if (size != cachedSize || order != cachedOrder) {
+        sequence = gridSequence(size, size, order);
+        cachedSize = size;
+        cachedOrder = order;
+    }
+    return sequence;
+}
@@ -0,0 +1,26 @@
+#ifndef TRAVERSAL_H
+#define TRAVERSAL_H
+
+#include <string>
+#include <vector>
+
+// Order in which tiles, or pixels inside a tile, are rendered. Space-filling curves keep
+// consecutive rays close together on screen, so they tend to touch the same objects and lights.
+enum TraversalOrder {
+    ORDER_ROWS,         // row by row, left to right
+    ORDER_MORTON,       // Z-order: interleaved x and y bits
+    ORDER_HILBERT       // Hilbert curve; every step moves to an edge neighbor
+};
+
+const char* traversalOrderName(TraversalOrder order);
+// Parse "rows", "morton" or "hilbert"; false for anything else
+bool parseTraversalOrder(const std::string& name, TraversalOrder& order);
+
+// Tile indices (ty * tilesX + tx) of a tilesX x tilesY grid in the given order
+std::vector<int> tileSequence(int tilesX, int tilesY, TraversalOrder order);
+
+// Pixels of a size x size tile in the given order, each as dy * size + dx. Cached per thread,
+// since every tile of a render asks for the same sequence.
+const std::vector<int>& pixelSequence(int size, TraversalOrder order);
+
+#endif // TRAVERSAL_H